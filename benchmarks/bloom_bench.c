@@ -0,0 +1,93 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bloom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Number of live elements in each filter */
+#define NUM_ELEMENTS (1 << 20)
+/** Number of times the whole element set is replaced */
+#define NUM_ROUNDS 8
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Elements are identified by sequence number, probes use numbers never added */
+#define element_hash(i) jhash_1word((uint32_t)(i), 0)
+#define probe_hash(i) jhash_1word((uint32_t)(i), 1)
+
+static void report(const char *filter, size_t n, size_t fp, double start) {
+  printf("%-14s fpr %.4f probe %6.2f ns/op\n", filter, (double)fp / n, (now() - start) * 1e9 / n);
+}
+
+/* Plain filters cannot forget removed elements */
+static void bench_bloom(size_t n) {
+  struct bloom bf;
+  size_t fp = 0;
+
+  bloom_init(&bf, n, BLOOM_DEFAULT_FPR);
+  for (size_t i = 0; i < n * NUM_ROUNDS; ++i) {
+    bloom_add(&bf, element_hash(i));
+  }
+
+  double start = now();
+  for (size_t i = 0; i < n; ++i) {
+    fp += bloom_test(&bf, probe_hash(i));
+  }
+  report("bloom", n, fp, start);
+  bloom_destroy(&bf);
+}
+
+static void bench_cbloom(const char *filter, size_t n, unsigned flags) {
+  struct cbloom cb;
+  size_t fp = 0;
+
+  cbloom_init(&cb, n, BLOOM_DEFAULT_FPR, flags);
+  for (size_t i = 0; i < n * NUM_ROUNDS; ++i) {
+    if (i >= n) {
+      cbloom_remove(&cb, element_hash(i - n));
+    }
+    cbloom_add(&cb, element_hash(i));
+  }
+
+  double start = now();
+  for (size_t i = 0; i < n; ++i) {
+    fp += cbloom_test(&cb, probe_hash(i));
+  }
+  report(filter, n, fp, start);
+
+  for (size_t i = n * (NUM_ROUNDS - 1); i < n * NUM_ROUNDS; ++i) {
+    assert(cbloom_test(&cb, element_hash(i)));
+  }
+  cbloom_destroy(&cb);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : NUM_ELEMENTS;
+
+  bench_bloom(n);
+  bench_cbloom("cbloom", n, 0);
+  bench_cbloom("cbloom-blocked", n, CBLOOM_BLOCKED);
+
+  return 0;
+}
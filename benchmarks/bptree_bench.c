@@ -0,0 +1,158 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bptree.h"
+#include "rbtree.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Number of entries in each index */
+#define NUM_ENTRIES (1 << 22)
+/** Number of entries visited by each range scan */
+#define SCAN_LENGTH 100
+
+struct item {
+  uint64_t key;
+  struct rb_node node;
+};
+
+/* Orders the tree by increasing key, see rb_insert() */
+#define key_cmp(a, b) ((a) > (b) ? -1 : (a) < (b) ? 1 : 0)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *index, const char *op, size_t n, double start) {
+  printf("%-9s %-9s %8.2f ns/op\n", index, op, (now() - start) * 1e9 / n);
+}
+
+/* Find the first node with a key not below key */
+static struct rb_node *rb_seek(struct rb_root *root, uint64_t key) {
+  struct rb_node *node = root->rb_node, *found = NULL;
+
+  while (node) {
+    if (rb_entry(node, struct item, node)->key >= key) {
+      found = node;
+      node = node->rb_left;
+    } else {
+      node = node->rb_right;
+    }
+  }
+  return found;
+}
+
+static void bench_rbtree(struct item *items, size_t n) {
+  struct rb_root root = RB_ROOT;
+  size_t found = 0;
+  uint64_t sum = 0;
+  double start;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert((&root), struct item, node, key, &items[i].node, key_cmp);
+  }
+  report("rbtree", "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += rb_find((&root), struct item, node, key, items[i].key, key_cmp) != NULL;
+  }
+  report("rbtree", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n / SCAN_LENGTH; ++i) {
+    struct rb_node *node = rb_seek(&root, items[i].key);
+    for (size_t j = 0; node && j < SCAN_LENGTH; ++j, node = rb_next(node)) {
+      sum += rb_entry(node, struct item, node)->key;
+    }
+  }
+  report("rbtree", "scan/key", n / SCAN_LENGTH * SCAN_LENGTH, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    struct item *item = rb_find((&root), struct item, node, key, items[i].key, key_cmp);
+    rb_erase(&item->node, &root);
+  }
+  report("rbtree", "delete", n, start);
+
+  assert(found == n && sum);
+}
+
+static void bench_bptree(struct item *items, size_t n) {
+  struct bptree tree;
+  size_t found = 0;
+  uint64_t sum = 0;
+  double start;
+
+  bptree_init(&tree);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    bptree_insert(&tree, items[i].key, &items[i]);
+  }
+  report("bptree", "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += bptree_find(&tree, items[i].key) != NULL;
+  }
+  report("bptree", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n / SCAN_LENGTH; ++i) {
+    struct bptree_cursor cur;
+    bool valid = bptree_seek(&tree, items[i].key, &cur);
+    for (size_t j = 0; valid && j < SCAN_LENGTH; ++j, valid = bptree_next(&cur)) {
+      sum += bptree_cursor_key(&cur);
+    }
+  }
+  report("bptree", "scan/key", n / SCAN_LENGTH * SCAN_LENGTH, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    bptree_delete(&tree, items[i].key, NULL);
+  }
+  report("bptree", "delete", n, start);
+
+  assert(found == n && sum && bptree_count(&tree) == 0);
+  bptree_destroy(&tree);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : NUM_ENTRIES;
+  struct item *items = calloc(n, sizeof(*items));
+  assert(items && n <= (1 << 24));
+
+  // Unique random keys, the low bits hold the index
+  srand(1);
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = (uint64_t)rand() << 24 | i;
+  }
+
+  bench_rbtree(items, n);
+  bench_bptree(items, n);
+
+  free(items);
+  return 0;
+}
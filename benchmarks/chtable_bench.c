@@ -0,0 +1,190 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chtable.h"
+#include "htable.h"
+#include "lfhtable.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Number of entries present during the run */
+#define NUM_ENTRIES (1 << 18)
+/** Number of operations done by each thread */
+#define NUM_OPS (1 << 20)
+/** One in this many operations is an insert followed by a delete */
+#define UPDATE_RATIO 10
+/** Number of entries each thread recycles for updates */
+#define RING_SIZE 256
+
+struct item {
+  uint64_t key;
+  struct htable_entry entry;
+  struct lfhtable_entry lfentry;
+};
+
+struct worker {
+  pthread_t thread;
+  unsigned id;
+  struct item ring[RING_SIZE];
+};
+
+static struct item *items;
+static struct chtable ctable;
+static struct htable table;
+static struct lfhtable lftable;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *chtable_worker(void *arg) {
+  struct worker *w = arg;
+  unsigned seed = w->id;
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    if (i % UPDATE_RATIO == 0) {
+      size_t j = i / UPDATE_RATIO;
+      struct item *item = &w->ring[j % RING_SIZE];
+      // Recycled entries must wait for readers which may still see them
+      if (j > 0 && j % RING_SIZE == 0) {
+        chtable_synchronize(&ctable);
+      }
+      item->key = (uint64_t)(w->id + 1) << 32 | j;
+      chtable_add(&ctable, &item->entry, &item->key, sizeof(item->key));
+      chtable_del_entry(&ctable, &item->entry);
+    } else {
+      uint64_t key = rand_r(&seed) % NUM_ENTRIES;
+      unsigned token = chtable_read_lock(&ctable);
+      struct htable_entry *e = chtable_find(&ctable, &key, sizeof(key));
+      assert(e);
+      (void)e;
+      chtable_read_unlock(&ctable, token);
+    }
+  }
+  return NULL;
+}
+
+static void *lfhtable_worker(void *arg) {
+  struct worker *w = arg;
+  unsigned seed = w->id;
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    if (i % UPDATE_RATIO == 0) {
+      size_t j = i / UPDATE_RATIO;
+      struct item *item = &w->ring[j % RING_SIZE];
+      // Recycled entries must wait for readers which may still see them
+      if (j > 0 && j % RING_SIZE == 0) {
+        lfhtable_synchronize(&lftable);
+      }
+      item->key = (uint64_t)(w->id + 1) << 32 | j;
+      lfhtable_add(&lftable, &item->lfentry, &item->key, sizeof(item->key));
+      lfhtable_del_entry(&lftable, &item->lfentry);
+    } else {
+      uint64_t key = rand_r(&seed) % NUM_ENTRIES;
+      unsigned token = lfhtable_read_lock(&lftable);
+      struct lfhtable_entry *e = lfhtable_find(&lftable, &key, sizeof(key));
+      assert(e);
+      (void)e;
+      lfhtable_read_unlock(&lftable, token);
+    }
+  }
+  return NULL;
+}
+
+static void *htable_worker(void *arg) {
+  struct worker *w = arg;
+  unsigned seed = w->id;
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    pthread_mutex_lock(&table_lock);
+    if (i % UPDATE_RATIO == 0) {
+      struct item *item = &w->ring[(i / UPDATE_RATIO) % RING_SIZE];
+      item->key = (uint64_t)(w->id + 1) << 32 | (i / UPDATE_RATIO);
+      htable_add(&table, &item->entry, &item->key, sizeof(item->key));
+      htable_del_entry(&table, &item->entry);
+    } else {
+      uint64_t key = rand_r(&seed) % NUM_ENTRIES;
+      struct htable_entry *e = htable_find(&table, &key, sizeof(key));
+      assert(e);
+      (void)e;
+    }
+    pthread_mutex_unlock(&table_lock);
+  }
+  return NULL;
+}
+
+static void run(const char *name, void *(*fn)(void *), unsigned nthreads) {
+  struct worker *workers = calloc(nthreads, sizeof(*workers));
+  assert(workers);
+
+  double start = now();
+  for (unsigned i = 0; i < nthreads; ++i) {
+    workers[i].id = i;
+    pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+  }
+  for (unsigned i = 0; i < nthreads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  double elapsed = now() - start;
+
+  printf("%-14s threads %3u %8.2f Mops/s\n", name, nthreads, nthreads * (double)NUM_OPS / elapsed / 1e6);
+  free(workers);
+}
+
+int main(int argc, char *argv[]) {
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned max_threads = argc > 1 ? strtoul(argv[1], NULL, 0) : (ncpus > 0 ? (unsigned long)ncpus : 1UL);
+
+  items = calloc(NUM_ENTRIES, sizeof(*items));
+  assert(items);
+
+  chtable_init(&ctable);
+  htable_init(&table);
+  lfhtable_init(&lftable);
+  for (size_t i = 0; i < NUM_ENTRIES; ++i) {
+    items[i].key = i;
+    chtable_add(&ctable, &items[i].entry, &items[i].key, sizeof(items[i].key));
+    lfhtable_add(&lftable, &items[i].lfentry, &items[i].key, sizeof(items[i].key));
+  }
+  // Entries can only be in one table at a time
+  struct item *copies = calloc(NUM_ENTRIES, sizeof(*copies));
+  assert(copies);
+  for (size_t i = 0; i < NUM_ENTRIES; ++i) {
+    copies[i].key = i;
+    htable_add(&table, &copies[i].entry, &copies[i].key, sizeof(copies[i].key));
+  }
+
+  for (unsigned n = 1; n <= max_threads; n <<= 1) {
+    run("htable+mutex", htable_worker, n);
+    run("chtable", chtable_worker, n);
+    run("lfhtable", lfhtable_worker, n);
+  }
+
+  chtable_destroy(&ctable);
+  htable_destroy(&table);
+  lfhtable_destroy(&lftable);
+  free(copies);
+  free(items);
+  return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hash function benchmark.
+ *
+ * Results are printed as CSV records "hash,test,size,metric,value" so that
+ * runs can be compared across releases:
+ *
+ *   speed      cycles per byte, and nanoseconds per key, for key sizes from
+ *              4 B to 64 KiB
+ *   avalanche  deviation from 0.5 of the probability that flipping an input
+ *              bit flips an output bit, the mean and worst over all pairs
+ *   buckets    chi-squared statistic of the bucket occupancy computed with
+ *              htable_which_bucket(), divided by its degrees of freedom,
+ *              about 1 for a uniform hash, for sequential integer keys and
+ *              for short text keys
+ *
+ * Only the low 32 bits of 64-bit hashes are tested, which is what htable
+ * uses. hash_64 is applied to keys one 64-bit word at a time through
+ * htable_hash_u64(), chaining the words. Cycles are counted with the time
+ * stamp counter where available, which ticks at a constant rate rather than
+ * the core clock.
+ */
+
+#include "compiler.h"
+#include "hash.h"
+#include "htable.h"
+#include "jhash.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define rdtsc() __rdtsc()
+#else
+#define rdtsc() 0
+#endif
+
+/** Largest key size measured */
+#define MAX_KEY_SIZE (64 << 10)
+/** Bytes hashed for each speed measurement */
+#define SPEED_BYTES (16 << 20)
+/** Number of random keys used by the avalanche test */
+#define AVALANCHE_KEYS 2000
+/** Largest key size for the avalanche test */
+#define AVALANCHE_MAX_SIZE 64
+/** Number of buckets for the distribution test */
+#define NUM_BUCKETS (1 << 16)
+/** Number of keys per bucket for the distribution test */
+#define KEYS_PER_BUCKET 8
+
+struct hash {
+  const char *name;
+  uint32_t (*fn)(const void *key, size_t len, uint32_t seed);
+  /** Key sizes must be a multiple of this */
+  size_t align;
+};
+
+static uint32_t fn_jhash(const void *key, size_t len, uint32_t seed) {
+  return jhash(key, len, seed);
+}
+
+static uint32_t fn_jhash2(const void *key, size_t len, uint32_t seed) {
+  return jhash2(key, len / sizeof(uint32_t), seed);
+}
+
+static uint32_t fn_hash64(const void *key, size_t len, uint32_t seed) {
+  const uint64_t *w = key;
+  uint32_t h = seed;
+  for (size_t i = 0; i < len / sizeof(uint64_t); ++i) {
+    h = htable_hash_u64(&w[i], sizeof(w[i]), h);
+  }
+  return h;
+}
+
+static uint32_t fn_hash_internal(const void *key, size_t len, uint32_t seed) {
+  return hash_internal(key, len) ^ seed;
+}
+
+static uint32_t fn_hash_bytes(const void *key, size_t len, uint32_t seed) {
+  return hash_bytes(seed, key, len);
+}
+
+static uint32_t fn_crc32c(const void *key, size_t len, uint32_t seed) {
+  return hash_crc32c(seed, key, len);
+}
+
+static const struct hash hashes[] = {
+  { "jhash", fn_jhash, 1 },
+  { "jhash2", fn_jhash2, sizeof(uint32_t) },
+  { "hash_64", fn_hash64, sizeof(uint64_t) },
+  { "hash_internal", fn_hash_internal, 1 },
+  { "hash_bytes", fn_hash_bytes, 1 },
+  { "hash_crc32c", fn_crc32c, 1 },
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void result(const char *hash, const char *test, size_t size, const char *metric, double value) {
+  printf("%s,%s,%zu,%s,%.4f\n", hash, test, size, metric, value);
+}
+
+static void bench_speed(const struct hash *h, const uint8_t *buf) {
+  for (size_t size = 4; size <= MAX_KEY_SIZE; size <<= 1) {
+    size_t n = SPEED_BYTES / size;
+    volatile uint32_t sink = 0;
+
+    if (size % h->align) {
+      continue;
+    }
+
+    double start = now();
+    uint64_t cycles = rdtsc();
+    for (size_t i = 0; i < n; ++i) {
+      // Walk the buffer so small keys do not always hit the same line
+      sink += h->fn(buf + (i * 64) % MAX_KEY_SIZE, size, i);
+    }
+    cycles = rdtsc() - cycles;
+    double elapsed = now() - start;
+
+    if (cycles) {
+      result(h->name, "speed", size, "cycles_per_byte", (double)cycles / (n * size));
+    }
+    result(h->name, "speed", size, "ns_per_key", elapsed * 1e9 / n);
+  }
+}
+
+static void bench_avalanche(const struct hash *h, size_t size) {
+  uint8_t key[AVALANCHE_MAX_SIZE];
+  static unsigned flips[AVALANCHE_MAX_SIZE * 8][32];
+  double worst = 0, sum = 0;
+
+  if (size % h->align || size > sizeof(key)) {
+    return;
+  }
+
+  memset(flips, 0, sizeof(flips));
+  for (unsigned k = 0; k < AVALANCHE_KEYS; ++k) {
+    for (size_t i = 0; i < size; ++i) {
+      key[i] = rand();
+    }
+    uint32_t base = h->fn(key, size, 0);
+    for (size_t bit = 0; bit < size * 8; ++bit) {
+      key[bit / 8] ^= 1 << (bit % 8);
+      uint32_t diff = base ^ h->fn(key, size, 0);
+      key[bit / 8] ^= 1 << (bit % 8);
+      for (int out = 0; out < 32; ++out) {
+        flips[bit][out] += (diff >> out) & 1;
+      }
+    }
+  }
+
+  for (size_t bit = 0; bit < size * 8; ++bit) {
+    for (int out = 0; out < 32; ++out) {
+      double bias = fabs((double)flips[bit][out] / AVALANCHE_KEYS - 0.5);
+      worst = bias > worst ? bias : worst;
+      sum += bias;
+    }
+  }
+  result(h->name, "avalanche", size, "mean_bias", sum / (size * 8 * 32));
+  result(h->name, "avalanche", size, "worst_bias", worst);
+}
+
+static void bench_buckets(const struct hash *h, const char *keys, size_t *counts) {
+  struct htable table;
+  size_t n = (size_t)NUM_BUCKETS * KEYS_PER_BUCKET;
+  char key[16];
+  size_t size;
+  double chi2 = 0;
+
+  htable_init_n(&table, NUM_BUCKETS);
+  memset(counts, 0, sizeof(size_t) * NUM_BUCKETS);
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!strcmp(keys, "sequential")) {
+      uint64_t v = i;
+      memcpy(key, &v, sizeof(v));
+      size = sizeof(v);
+    } else {
+      // Text keys padded to the hash alignment
+      memset(key, 0, sizeof(key));
+      snprintf(key, sizeof(key), "key%zu", i);
+      size = ALIGN(strlen(key), h->align);
+    }
+    counts[htable_which_bucket(&table, h->fn(key, size, 0))]++;
+  }
+
+  for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+    double d = (double)counts[i] - KEYS_PER_BUCKET;
+    chi2 += d * d / KEYS_PER_BUCKET;
+  }
+  result(h->name, "buckets", NUM_BUCKETS, keys, chi2 / (NUM_BUCKETS - 1));
+
+  htable_destroy(&table);
+}
+
+int main(void) {
+  uint8_t *buf = malloc(MAX_KEY_SIZE * 2);
+  size_t *counts = malloc(sizeof(size_t) * NUM_BUCKETS);
+  assert(buf && counts);
+
+  srand(1);
+  for (size_t i = 0; i < MAX_KEY_SIZE * 2; ++i) {
+    buf[i] = rand();
+  }
+
+  printf("hash,test,size,metric,value\n");
+  for (size_t i = 0; i < ARRAY_SIZE(hashes); ++i) {
+    bench_speed(&hashes[i], buf);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(hashes); ++i) {
+    bench_avalanche(&hashes[i], 8);
+    bench_avalanche(&hashes[i], 32);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(hashes); ++i) {
+    bench_buckets(&hashes[i], "sequential", counts);
+    bench_buckets(&hashes[i], "text", counts);
+  }
+
+  free(counts);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cuckoo.h"
+#include "htable.h"
+#include "imap.h"
+#include "mph.h"
+#include "ohtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Number of entries inserted into each table */
+#define NUM_ENTRIES (1 << 20)
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+  struct ohtable_entry oentry;
+  struct cuckoo_entry centry;
+};
+
+DEFINE_IMAP(item_map, uint64_t, struct item *)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *table, const char *op, size_t n, double start) {
+  printf("%-9s %-9s %8.2f ns/op\n", table, op, (now() - start) * 1e9 / n);
+}
+
+static void bench_htable(const char *name, struct item *items, size_t n,
+    unsigned (*hash)(const void *key, size_t len, unsigned seed)) {
+  struct htable table;
+  size_t found = 0, batch_found = 0;
+  double start;
+
+  htable_init_hash(&table, HASH_NUM_BUCKETS, hash, 0);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(items[i].key));
+  }
+  report(name, "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += htable_find(&table, &items[i].key, sizeof(items[i].key)) != NULL;
+  }
+  report(name, "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; i += HTABLE_BATCH_SIZE) {
+    const void *keys[HTABLE_BATCH_SIZE];
+    size_t lens[HTABLE_BATCH_SIZE];
+    struct htable_entry *results[HTABLE_BATCH_SIZE];
+    size_t count = min_t(size_t, n - i, HTABLE_BATCH_SIZE);
+    for (size_t j = 0; j < count; ++j) {
+      keys[j] = &items[i + j].key;
+      lens[j] = sizeof(items[i + j].key);
+    }
+    batch_found += htable_find_batch(&table, keys, lens, count, results);
+  }
+  report(name, "hit/batch", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[i].key + 1;
+    found += htable_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report(name, "miss", n, start);
+
+  assert(found == n && batch_found == n);
+  htable_destroy(&table);
+}
+
+static void bench_ohtable(struct item *items, size_t n) {
+  struct ohtable table;
+  size_t found = 0;
+  double start;
+
+  int ret = ohtable_init(&table);
+  assert(ret == 0);
+  (void)ret;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    ret = ohtable_add(&table, &items[i].oentry, &items[i].key, sizeof(items[i].key));
+    assert(ret == 0);
+  }
+  report("ohtable", "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += ohtable_find(&table, &items[i].key, sizeof(items[i].key)) != NULL;
+  }
+  report("ohtable", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[i].key + 1;
+    found += ohtable_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report("ohtable", "miss", n, start);
+
+  assert(found == n);
+  ohtable_destroy(&table);
+}
+
+static void bench_cuckoo(struct item *items, size_t n) {
+  struct cuckoo table;
+  size_t found = 0;
+  double start;
+
+  int ret = cuckoo_init(&table);
+  assert(ret == 0);
+  (void)ret;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    cuckoo_add(&table, &items[i].centry, &items[i].key, sizeof(items[i].key));
+  }
+  report("cuckoo", "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += cuckoo_find(&table, &items[i].key, sizeof(items[i].key)) != NULL;
+  }
+  report("cuckoo", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[i].key + 1;
+    found += cuckoo_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report("cuckoo", "miss", n, start);
+
+  assert(found == n);
+  cuckoo_destroy(&table);
+}
+
+static void bench_imap(struct item *items, size_t n) {
+  struct item_map map;
+  size_t found = 0;
+  double start;
+
+  int ret = item_map_init(&map);
+  assert(ret == 0);
+  (void)ret;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    item_map_put(&map, items[i].key, &items[i]);
+  }
+  report("imap", "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += item_map_find(&map, items[i].key) != NULL;
+  }
+  report("imap", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += item_map_find(&map, items[i].key + 1) != NULL;
+  }
+  report("imap", "miss", n, start);
+
+  assert(found == n);
+  item_map_destroy(&map);
+}
+
+/* Static key set, keys are stored in index order and compared once */
+static void bench_mph(struct item *items, size_t n) {
+  const void **keys = malloc(n * sizeof(*keys));
+  size_t *lens = malloc(n * sizeof(*lens));
+  uint64_t *table = malloc(n * sizeof(*table));
+  struct mph mph;
+  size_t found = 0;
+  double start;
+
+  assert(keys && lens && table);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = &items[i].key;
+    lens[i] = sizeof(items[i].key);
+  }
+
+  start = now();
+  int ret = mph_build(&mph, keys, lens, n, 0);
+  assert(ret == 0);
+  (void)ret;
+  for (size_t i = 0; i < n; ++i) {
+    table[mph_index(&mph, &items[i].key, sizeof(items[i].key))] = items[i].key;
+  }
+  report("mph", "build", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += table[mph_index(&mph, &items[i].key, sizeof(items[i].key))] == items[i].key;
+  }
+  report("mph", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[i].key + 1;
+    found += table[mph_index(&mph, &key, sizeof(key))] == key;
+  }
+  report("mph", "miss", n, start);
+
+  assert(found == n);
+  mph_destroy(&mph);
+  free(table);
+  free(lens);
+  free(keys);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : NUM_ENTRIES;
+  struct item *items = calloc(n, sizeof(*items));
+  assert(items);
+
+  // Even keys are present, odd keys are used for misses
+  srand(1);
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = ((uint64_t)rand() << 32 | (uint64_t)rand() << 1) & ~1ULL;
+  }
+
+  bench_htable("htable", items, n, NULL);
+  bench_htable("htable64", items, n, htable_hash_u64);
+  bench_ohtable(items, n);
+  bench_cuckoo(items, n);
+  bench_imap(items, n);
+  bench_mph(items, n);
+
+  free(items);
+  return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "htable.h"
+#include "hugepage.h"
+#include "imap.h"
+#include "ohtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Number of entries inserted into each table */
+#define NUM_ENTRIES 10000000
+
+struct item {
+  uint64_t key;
+  struct htable_entry hentry;
+  struct ohtable_entry oentry;
+};
+
+DEFINE_IMAP(item_map, uint64_t, struct item *)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *table, const char *op, size_t n, double start) {
+  printf("%-9s %-9s %8.2f ns/op\n", table, op, (now() - start) * 1e9 / n);
+}
+
+static void bench_htable(const char *name, unsigned flags, struct item *items,
+    const uint32_t *order, size_t n) {
+  struct htable table;
+  size_t found = 0;
+  double start;
+
+  // Sized for the entries up front, so only the lookups are measured
+  htable_init_flags(&table, n, flags);
+  table.hash = htable_hash_u64;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(items[i].key));
+  }
+  report(name, "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    struct item *item = &items[order[i]];
+    found += htable_find(&table, &item->key, sizeof(item->key)) != NULL;
+  }
+  report(name, "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[order[i]].key + 1;
+    found += htable_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report(name, "miss", n, start);
+
+  assert(found == n);
+  htable_destroy(&table);
+}
+
+static void bench_ohtable(const char *name, unsigned flags, struct item *items,
+    const uint32_t *order, size_t n) {
+  struct ohtable table;
+  size_t found = 0;
+  double start;
+
+  int ret = ohtable_init_flags(&table, n, flags);
+  assert(ret == 0);
+  (void)ret;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    ret = ohtable_add(&table, &items[i].oentry, &items[i].key, sizeof(items[i].key));
+    assert(ret == 0);
+  }
+  report(name, "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    struct item *item = &items[order[i]];
+    found += ohtable_find(&table, &item->key, sizeof(item->key)) != NULL;
+  }
+  report(name, "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = items[order[i]].key + 1;
+    found += ohtable_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report(name, "miss", n, start);
+
+  assert(found == n);
+  ohtable_destroy(&table);
+}
+
+static void bench_map(const char *name, unsigned flags, struct item *items,
+    const uint32_t *order, size_t n) {
+  struct item_map map;
+  size_t found = 0;
+  double start;
+
+  int ret = item_map_init_flags(&map, n, flags);
+  assert(ret == 0);
+  (void)ret;
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    ret = item_map_put(&map, items[i].key, &items[i]);
+    assert(ret == 0);
+  }
+  report(name, "insert", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += item_map_find(&map, items[order[i]].key) != NULL;
+  }
+  report(name, "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    found += item_map_find(&map, items[order[i]].key + 1) != NULL;
+  }
+  report(name, "miss", n, start);
+
+  assert(found == n);
+  item_map_destroy(&map);
+}
+
+int main(void) {
+  size_t n = NUM_ENTRIES;
+  struct item *items = hugepage_alloc(n * sizeof(*items));
+  uint32_t *order = malloc(n * sizeof(*order));
+
+  if (!items || !order) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  // Even keys, so that key + 1 always misses
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = i * 2;
+    order[i] = i;
+  }
+  // Random lookup order, so consecutive lookups hit unrelated buckets
+  srand(1);
+  for (size_t i = n - 1; i > 0; --i) {
+    size_t j = ((size_t)rand() << 16 ^ rand()) % (i + 1);
+    uint32_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  bench_htable("htable", 0, items, order, n);
+  bench_htable("htable/hp", HTABLE_HUGE_PAGES, items, order, n);
+  bench_ohtable("ohtable", 0, items, order, n);
+  bench_ohtable("ohtable/hp", OHTABLE_HUGE_PAGES, items, order, n);
+  bench_map("map", 0, items, order, n);
+  bench_map("map/hp", OHTABLE_HUGE_PAGES, items, order, n);
+
+  hugepage_free(items, n * sizeof(*items));
+  free(order);
+  return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "htable.h"
+#include "mhtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Number of entries in the table */
+#define NUM_ENTRIES (1 << 20)
+
+struct item {
+  uint64_t key;
+  uint64_t val;
+  struct htable_entry hentry;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *table, const char *op, size_t n, double start) {
+  printf("%-9s %-9s %8.2f ns/op\n", table, op, (now() - start) * 1e9 / n);
+}
+
+/* Start up by reading all entries from the table file into a htable */
+static void bench_htable(const char *path, size_t n) {
+  struct mhtable mt;
+  struct htable table;
+  struct item *items = calloc(n, sizeof(*items));
+  size_t found = 0;
+  double start;
+
+  assert(items);
+  start = now();
+  mhtable_open(&mt, path);
+  htable_init_n(&table, n);
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = (uint64_t)i << 1;
+    items[i].key = key;
+    items[i].val = *(const uint64_t *)mhtable_find(&mt, &key, sizeof(key), NULL);
+    htable_add(&table, &items[i].hentry, &items[i].key, sizeof(items[i].key));
+  }
+  mhtable_close(&mt);
+  report("htable", "load", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = (uint64_t)i << 1;
+    found += htable_find(&table, &key, sizeof(key)) != NULL;
+  }
+  report("htable", "hit", n, start);
+
+  assert(found == n);
+  htable_destroy(&table);
+  free(items);
+}
+
+static void bench_mhtable(const char *path, size_t n) {
+  struct mhtable mt;
+  size_t found = 0;
+  double start;
+
+  start = now();
+  mhtable_open(&mt, path);
+  report("mhtable", "load", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = (uint64_t)i << 1;
+    const uint64_t *val = mhtable_find(&mt, &key, sizeof(key), NULL);
+    found += val && *val == i;
+  }
+  report("mhtable", "hit", n, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = (uint64_t)i << 1 | 1;
+    found += mhtable_find(&mt, &key, sizeof(key), NULL) != NULL;
+  }
+  report("mhtable", "miss", n, start);
+
+  assert(found == n);
+  mhtable_close(&mt);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : NUM_ENTRIES;
+  char path[] = "/tmp/mhtable_bench.XXXXXX";
+  struct mhtable_builder builder;
+  double start;
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  // Even keys are present, odd keys are used for misses
+  start = now();
+  mhtable_builder_init(&builder, 0);
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t key = (uint64_t)i << 1, val = i;
+    mhtable_builder_add(&builder, &key, sizeof(key), &val, sizeof(val));
+  }
+  int ret = mhtable_builder_write(&builder, path);
+  assert(ret == 0);
+  (void)ret;
+  mhtable_builder_destroy(&builder);
+  report("mhtable", "build", n, start);
+
+  bench_htable(path, n);
+  bench_mhtable(path, n);
+
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compiler.h"
+#include "rbtree.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Number of nodes in each tree */
+#define NUM_ENTRIES (1 << 20)
+/** Number of scheduler ticks simulated */
+#define NUM_TICKS (1 << 22)
+
+struct item {
+  uint64_t key;
+  struct rb_node node;
+};
+
+/* Orders the tree by increasing key, see rb_insert() */
+#define key_cmp(a, b) ((a) > (b) ? -1 : (a) < (b) ? 1 : 0)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *tree, const char *op, size_t n, double start) {
+  printf("%-9s %-9s %8.2f ns/op\n", tree, op, (now() - start) * 1e9 / n);
+}
+
+static void bench_rbtree(struct item *items, size_t n) {
+  struct rb_root root = RB_ROOT;
+  uint64_t sum = 0;
+  double start;
+
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert((&root), struct item, node, key, &items[i].node, key_cmp);
+  }
+
+  start = now();
+  for (size_t i = 0; i < NUM_TICKS; ++i) {
+    barrier();
+    sum += rb_entry(rb_first(&root), struct item, node)->key;
+  }
+  report("rbtree", "first", NUM_TICKS, start);
+
+  // Deadline scheduler tick, run the earliest item and queue it again
+  start = now();
+  for (size_t i = 0; i < NUM_TICKS; ++i) {
+    struct rb_node *first = rb_first(&root);
+    struct item *item = rb_entry(first, struct item, node);
+    rb_erase(first, &root);
+    item->key += n << 20;
+    rb_insert((&root), struct item, node, key, first, key_cmp);
+  }
+  report("rbtree", "tick", NUM_TICKS, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    struct rb_node *first = rb_first(&root);
+    rb_erase(first, &root);
+  }
+  report("rbtree", "pop", n, start);
+
+  assert(RB_EMPTY_ROOT(&root) && sum);
+}
+
+static void bench_cached(struct item *items, size_t n) {
+  struct rb_root_cached root = RB_ROOT_CACHED;
+  uint64_t sum = 0;
+  double start;
+
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert_cached((&root), struct item, node, key, &items[i].node, key_cmp);
+  }
+
+  start = now();
+  for (size_t i = 0; i < NUM_TICKS; ++i) {
+    // Reload the cached node, as a scheduler would after other tree updates
+    barrier();
+    sum += rb_entry(rb_first_cached(&root), struct item, node)->key;
+  }
+  report("cached", "first", NUM_TICKS, start);
+
+  start = now();
+  for (size_t i = 0; i < NUM_TICKS; ++i) {
+    struct rb_node *first = rb_pop_first_cached(&root);
+    struct item *item = rb_entry(first, struct item, node);
+    item->key += n << 20;
+    rb_insert_cached((&root), struct item, node, key, first, key_cmp);
+  }
+  report("cached", "tick", NUM_TICKS, start);
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    rb_pop_first_cached(&root);
+  }
+  report("cached", "pop", n, start);
+
+  assert(RB_EMPTY_ROOT(&root.rb_root) && !rb_first_cached(&root) && sum);
+}
+
+/* Sorted input, inserted one by one at the right end or built at once */
+static void bench_build(struct item *items, size_t n) {
+  struct rb_node **nodes = malloc(n * sizeof(*nodes));
+  struct rb_root root = RB_ROOT;
+  double start;
+
+  assert(nodes);
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = i;
+    nodes[i] = &items[i].node;
+  }
+
+  start = now();
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert((&root), struct item, node, key, &items[i].node, key_cmp);
+  }
+  report("sorted", "insert", n, start);
+
+  start = now();
+  rb_build(&root, nodes, n);
+  report("sorted", "build", n, start);
+
+  root = RB_ROOT;
+  rb_build(&root, nodes, n / 2);
+  start = now();
+  rb_append(&root, nodes + n / 2, n - n / 2);
+  report("sorted", "append", n - n / 2, start);
+
+  assert(rb_entry(rb_last(&root), struct item, node)->key == n - 1);
+  free(nodes);
+}
+
+/* Time window scans of WINDOW keys, items hold keys 0 to n - 1 */
+#define WINDOW 64
+static void bench_range(struct item *items, size_t n) {
+  struct rb_root root = RB_ROOT;
+  struct rb_node *pos, *erased;
+  size_t scans = n / WINDOW, found = 0, deleted = 0;
+  double start;
+
+  for (size_t i = 0; i < n; ++i) {
+    rb_insert((&root), struct item, node, key, &items[i].node, key_cmp);
+  }
+
+  start = now();
+  for (size_t i = 0; i < scans; ++i) {
+    uint64_t lo = (uint64_t)rand() % n;
+    rb_for_each_range(pos, (&root), struct item, node, key, lo, lo + WINDOW, key_cmp) {
+      found++;
+    }
+  }
+  report("range", "scan", scans, start);
+
+  start = now();
+  for (uint64_t lo = 0; lo < n; lo += WINDOW) {
+    deleted += rb_delete_range((&root), struct item, node, key, lo, lo + WINDOW, key_cmp, &erased);
+  }
+  report("range", "delete", (n + WINDOW - 1) / WINDOW, start);
+
+  assert(RB_EMPTY_ROOT(&root) && deleted == n && found <= scans * WINDOW);
+}
+
+static void init_items(struct item *items, size_t n) {
+  // Unique random keys, the low bits hold the index
+  srand(1);
+  for (size_t i = 0; i < n; ++i) {
+    items[i].key = (uint64_t)rand() << 20 | i;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : NUM_ENTRIES;
+  struct item *items = calloc(n, sizeof(*items));
+  assert(items && n > 0 && n <= (1 << 20));
+
+  init_items(items, n);
+  bench_rbtree(items, n);
+  init_items(items, n);
+  bench_cached(items, n);
+  bench_build(items, n);
+  bench_range(items, n);
+
+  free(items);
+  return 0;
+}
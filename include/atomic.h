@@ -32,6 +32,11 @@
 
 #define _Atomic(T) struct { volatile T __val; }
 
+// Compilers predefining the memory orders provide the __atomic builtins
+#if !defined(__GNUC_ATOMICS) && defined(__ATOMIC_RELAXED)
+#define __GNUC_ATOMICS
+#endif
+
 // Initialization
 #define ATOMIC_VAR_INIT(value) { .__val = (value) }
 #define atomic_init(obj, value) do { \
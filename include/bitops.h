@@ -130,6 +130,43 @@ static inline unsigned long __ffs64(uint64_t word) {
     return __ffs((unsigned long)word);
 }
 
+/**
+ * Find last (most-significant) set bit in word.
+ *
+ * The result is not defined if no bit exists.
+ *
+ * @param word word to search
+ */
+static inline unsigned long __fls(unsigned long word) {
+    int num = BITS_PER_LONG - 1;
+
+#if __WORDSIZE == 64
+    if (!(word & (~0ul << 32))) {
+        num -= 32;
+        word <<= 32;
+    }
+#endif
+    if (!(word & (~0ul << (BITS_PER_LONG - 16)))) {
+        num -= 16;
+        word <<= 16;
+    }
+    if (!(word & (~0ul << (BITS_PER_LONG - 8)))) {
+        num -= 8;
+        word <<= 8;
+    }
+    if (!(word & (~0ul << (BITS_PER_LONG - 4)))) {
+        num -= 4;
+        word <<= 4;
+    }
+    if (!(word & (~0ul << (BITS_PER_LONG - 2)))) {
+        num -= 2;
+        word <<= 2;
+    }
+    if (!(word & (~0ul << (BITS_PER_LONG - 1))))
+        num -= 1;
+    return num;
+}
+
 /**
  * Find first zero in word.
  *
@@ -186,7 +223,7 @@ static inline int fls64(uint64_t x) {
 static inline int fls64(uint64_t x) {
     if (x == 0)
         return 0;
-    return __ffs(x) + 1;
+    return __fls(x) + 1;
 }
 #endif
 
@@ -267,6 +304,17 @@ static inline uint8_t ror8(uint8_t word, unsigned int shift) {
     return (word >> shift) | (word << (8 - shift));
 }
 
+/**
+ * Reverse the order of bits in a 32-bit value.
+ * @param x value to reverse
+ */
+static inline uint32_t bitrev32(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    return __builtin_bswap32(x);
+}
+
 #define for_each_set_bit(bit, addr, size) \
     for ((bit) = find_first_bit((addr), (size)); \
          (bit) < (size); \
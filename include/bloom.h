@@ -0,0 +1,267 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bloom filter sized from the expected number of elements and the target
+ * false positive rate.
+ *
+ * Elements are added by their 32-bit hash, typically the jhash of the key.
+ * The k bit positions are derived from it by double hashing, i.e.
+ * g_i = h1 + i * h2 where h2 is a second hash of h1, so callers which
+ * already hold the key hash never hash the key again.
+ */
+
+/** Default false positive rate */
+#define BLOOM_DEFAULT_FPR 0.01
+/** Upper bound on the number of hash functions */
+#define BLOOM_MAX_HASHES 16
+/** Seed of the second hash used for double hashing */
+#define BLOOM_SEED 0x9e3779b9
+
+/** Bloom filter */
+struct bloom {
+  /** Bit vector */
+  unsigned long *bits;
+  /** Number of bits in the bit vector */
+  size_t nbits;
+  /** Number of hash functions */
+  unsigned nhashes;
+  /** Number of elements added since the last reset */
+  size_t count;
+};
+
+/** Counters live in cache-line sized blocks, one block per element */
+#define CBLOOM_BLOCKED 0x1
+
+/** Size of a counting filter block in bytes */
+#define CBLOOM_BLOCK_SIZE 64
+/** Number of 4-bit counters in a block */
+#define CBLOOM_BLOCK_COUNTERS (CBLOOM_BLOCK_SIZE * 2)
+/** Counter value which is never incremented nor decremented */
+#define CBLOOM_COUNTER_MAX 15
+
+/** Counting Bloom filter supporting removal */
+struct cbloom {
+  /** Vector of 4-bit counters, two per byte */
+  uint8_t *counters;
+  /** Number of counters in the vector */
+  size_t ncounters;
+  /** Number of hash functions */
+  unsigned nhashes;
+  /** Layout flags */
+  unsigned flags;
+  /** Number of elements in the filter */
+  size_t count;
+};
+
+/* Externals are commented with implementation */
+extern int bloom_init(struct bloom *bf, size_t n, double fpr);
+extern void bloom_destroy(struct bloom *bf);
+extern void bloom_clear(struct bloom *bf);
+extern double bloom_fill_ratio(const struct bloom *bf);
+
+extern int cbloom_init(struct cbloom *cb, size_t n, double fpr, unsigned flags);
+extern void cbloom_destroy(struct cbloom *cb);
+extern void cbloom_clear(struct cbloom *cb);
+extern double cbloom_fill_ratio(const struct cbloom *cb);
+
+/**
+ * Map a 32-bit hash onto a bit index without a division.
+ *
+ * @param bf bloom filter
+ * @param hash hash value
+ */
+#define bloom_bit(bf, hash) ((size_t)(((uint64_t)(uint32_t)(hash) * (bf)->nbits) >> 32))
+
+/**
+ * Second hash used to derive the bit positions, always odd.
+ *
+ * @param hash hash of the element
+ */
+#define bloom_hash2(hash) (jhash_1word((hash), BLOOM_SEED) | 1)
+
+/**
+ * Add element with given hash into the filter.
+ *
+ * @param bf bloom filter
+ * @param hash hash of the element
+ */
+static inline void bloom_add(struct bloom *bf, uint32_t hash) {
+  uint32_t h2 = bloom_hash2(hash);
+
+  for (unsigned i = 0; i < bf->nhashes; ++i, hash += h2) {
+    size_t bit = bloom_bit(bf, hash);
+    bf->bits[bit / BITS_PER_LONG] |= 1UL << (bit % BITS_PER_LONG);
+  }
+  bf->count++;
+}
+
+/**
+ * Test whether element with given hash may be in the filter.
+ *
+ * @param bf bloom filter
+ * @param hash hash of the element
+ * @return false if the element is definitely not present, true otherwise
+ */
+static inline bool bloom_test(const struct bloom *bf, uint32_t hash) {
+  uint32_t h2 = bloom_hash2(hash);
+
+  for (unsigned i = 0; i < bf->nhashes; ++i, hash += h2) {
+    size_t bit = bloom_bit(bf, hash);
+    if (!(bf->bits[bit / BITS_PER_LONG] & (1UL << (bit % BITS_PER_LONG)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Add key into the filter.
+ *
+ * @param bf bloom filter
+ * @param key the pointer to key
+ * @param len the key length
+ */
+static inline void bloom_add_key(struct bloom *bf, const void *key, size_t len) {
+  bloom_add(bf, jhash(key, len, 0));
+}
+
+/**
+ * Test whether key may be in the filter.
+ *
+ * @param bf bloom filter
+ * @param key the pointer to key
+ * @param len the key length
+ */
+static inline bool bloom_test_key(const struct bloom *bf, const void *key, size_t len) {
+  return bloom_test(bf, jhash(key, len, 0));
+}
+
+/**
+ * Get the index of the i-th counter of an element.
+ *
+ * Blocked filters pick a block from the element hash and take all counters
+ * from the top bits of the derived hashes, so a probe touches one cache
+ * line at the cost of more counters for the same false positive rate.
+ *
+ * @param cb counting bloom filter
+ * @param hash hash of the element
+ * @param g i-th derived hash of the element
+ */
+static inline size_t cbloom_counter(const struct cbloom *cb, uint32_t hash, uint32_t g) {
+  if (cb->flags & CBLOOM_BLOCKED) {
+    size_t block = ((uint64_t)hash * (cb->ncounters / CBLOOM_BLOCK_COUNTERS)) >> 32;
+    return block * CBLOOM_BLOCK_COUNTERS + (g >> (32 - ilog2(CBLOOM_BLOCK_COUNTERS)));
+  }
+  return ((uint64_t)g * cb->ncounters) >> 32;
+}
+
+/**
+ * Step between the derived hashes of an element, always odd.
+ *
+ * Plain filters step by the element hash, which is independent from the
+ * first derived hash. Blocked filters already pick the block from the
+ * element hash and step by a rotation of the derived hash instead.
+ *
+ * @param cb counting bloom filter
+ * @param hash hash of the element
+ * @param g first derived hash of the element
+ */
+#define cbloom_step(cb, hash, g) \
+  (((cb)->flags & CBLOOM_BLOCKED ? rol32((g), 16) : (uint32_t)(hash)) | 1)
+
+#define cbloom_get(cb, idx) \
+  (((cb)->counters[(idx) >> 1] >> (((idx) & 1) << 2)) & 0xf)
+#define cbloom_inc(cb, idx) \
+  ((cb)->counters[(idx) >> 1] += 1 << (((idx) & 1) << 2))
+#define cbloom_dec(cb, idx) \
+  ((cb)->counters[(idx) >> 1] -= 1 << (((idx) & 1) << 2))
+
+/**
+ * Add element with given hash into the counting filter.
+ *
+ * Counters saturate at CBLOOM_COUNTER_MAX and are never decremented
+ * afterwards, which keeps the filter free of false negatives.
+ *
+ * @param cb counting bloom filter
+ * @param hash hash of the element
+ */
+static inline void cbloom_add(struct cbloom *cb, uint32_t hash) {
+  uint32_t g = bloom_hash2(hash), h3 = cbloom_step(cb, hash, g);
+
+  for (unsigned i = 0; i < cb->nhashes; ++i, g += h3) {
+    size_t idx = cbloom_counter(cb, hash, g);
+    if (cbloom_get(cb, idx) < CBLOOM_COUNTER_MAX) {
+      cbloom_inc(cb, idx);
+    }
+  }
+  cb->count++;
+}
+
+/**
+ * Remove element with given hash from the counting filter.
+ *
+ * The element must have been added before, removing elements which are
+ * not in the filter introduces false negatives.
+ *
+ * @param cb counting bloom filter
+ * @param hash hash of the element
+ */
+static inline void cbloom_remove(struct cbloom *cb, uint32_t hash) {
+  uint32_t g = bloom_hash2(hash), h3 = cbloom_step(cb, hash, g);
+
+  for (unsigned i = 0; i < cb->nhashes; ++i, g += h3) {
+    size_t idx = cbloom_counter(cb, hash, g);
+    unsigned counter = cbloom_get(cb, idx);
+    if (counter > 0 && counter < CBLOOM_COUNTER_MAX) {
+      cbloom_dec(cb, idx);
+    }
+  }
+  cb->count--;
+}
+
+/**
+ * Test whether element with given hash may be in the counting filter.
+ *
+ * @param cb counting bloom filter
+ * @param hash hash of the element
+ * @return false if the element is definitely not present, true otherwise
+ */
+static inline bool cbloom_test(const struct cbloom *cb, uint32_t hash) {
+  uint32_t g = bloom_hash2(hash), h3 = cbloom_step(cb, hash, g);
+
+  for (unsigned i = 0; i < cb->nhashes; ++i, g += h3) {
+    size_t idx = cbloom_counter(cb, hash, g);
+    if (!cbloom_get(cb, idx)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif // BLOOM_H_
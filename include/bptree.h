@@ -0,0 +1,178 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BPTREE_H_
+#define BPTREE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * B+tree mapping 64-bit keys to pointers.
+ *
+ * Nodes are BPTREE_NODE_SIZE bytes, four cache lines, aligned to a cache
+ * line. An inner node holds 15 keys and 16 children and a leaf holds 14
+ * key and value pairs, so a tree of millions of entries is five or six
+ * levels deep, with about one cache miss per level. Searches within a
+ * node scan the keys without branching on each comparison.
+ *
+ * Values are kept in the leaves only, which are linked in key order so
+ * cursors move to the next or previous entry in constant time. A cursor
+ * stays valid until the tree is next modified.
+ *
+ * Example, a range scan:
+ *
+ *   struct bptree_cursor cur;
+ *   bptree_for_each_range(&cur, &tree, lo, hi)
+ *     visit(bptree_cursor_key(&cur), *bptree_cursor_val(&cur));
+ */
+
+/** Size of a tree node in bytes */
+#define BPTREE_NODE_SIZE 256
+/** Alignment of tree nodes */
+#define BPTREE_NODE_ALIGN 64
+/** Maximum number of levels of a tree */
+#define BPTREE_MAX_HEIGHT 32
+
+/** Header common to inner nodes and leaves */
+struct bptree_node {
+    /** Whether the node is a leaf */
+    uint32_t leaf;
+    /** Number of keys in the node */
+    uint32_t count;
+};
+
+/** Number of keys in an inner node */
+#define BPTREE_INNER_KEYS ((BPTREE_NODE_SIZE - sizeof(struct bptree_node) - sizeof(void *)) / \
+        (sizeof(uint64_t) + sizeof(void *)))
+/** Number of entries in a leaf */
+#define BPTREE_LEAF_KEYS ((BPTREE_NODE_SIZE - sizeof(struct bptree_node) - 2 * sizeof(void *)) / \
+        (sizeof(uint64_t) + sizeof(void *)))
+
+/** Inner node, keys in children[i] are below keys[i], those in children[i + 1] are not */
+struct bptree_inner {
+    struct bptree_node hdr;
+    uint64_t keys[BPTREE_INNER_KEYS];
+    struct bptree_node *children[BPTREE_INNER_KEYS + 1];
+};
+
+/** Leaf node, linked with its neighbours in key order */
+struct bptree_leaf {
+    struct bptree_node hdr;
+    struct bptree_leaf *prev;
+    struct bptree_leaf *next;
+    uint64_t keys[BPTREE_LEAF_KEYS];
+    void *vals[BPTREE_LEAF_KEYS];
+};
+
+/** B+tree */
+struct bptree {
+    /** Root node, NULL when the tree is empty */
+    struct bptree_node *root;
+    /** Number of levels, 0 when the tree is empty */
+    unsigned height;
+    /** Number of entries */
+    size_t count;
+    /** First leaf in key order */
+    struct bptree_leaf *first;
+    /** Last leaf in key order */
+    struct bptree_leaf *last;
+};
+
+/** Position of an entry in the tree */
+struct bptree_cursor {
+    /** Leaf holding the entry, NULL past either end of the tree */
+    struct bptree_leaf *leaf;
+    /** Index of the entry in the leaf */
+    unsigned pos;
+};
+
+#define BPTREE_INIT (struct bptree) { NULL, 0, 0, NULL, NULL }
+
+/* Externals are commented with implementation */
+extern void bptree_init(struct bptree *tree);
+extern void bptree_destroy(struct bptree *tree);
+extern void **bptree_find(const struct bptree *tree, uint64_t key);
+extern int bptree_insert(struct bptree *tree, uint64_t key, void *val);
+extern int bptree_delete(struct bptree *tree, uint64_t key, void **val);
+
+extern bool bptree_first(const struct bptree *tree, struct bptree_cursor *cur);
+extern bool bptree_last(const struct bptree *tree, struct bptree_cursor *cur);
+extern bool bptree_seek(const struct bptree *tree, uint64_t key, struct bptree_cursor *cur);
+extern bool bptree_next(struct bptree_cursor *cur);
+extern bool bptree_prev(struct bptree_cursor *cur);
+
+/**
+ * Returns the number of entries in the tree.
+ *
+ * @param tree B+tree
+ */
+static inline size_t bptree_count(const struct bptree *tree) {
+    return tree->count;
+}
+
+/**
+ * Returns the key of the entry at the cursor.
+ *
+ * @param cur valid cursor
+ */
+static inline uint64_t bptree_cursor_key(const struct bptree_cursor *cur) {
+    return cur->leaf->keys[cur->pos];
+}
+
+/**
+ * Returns the value of the entry at the cursor, which may be changed.
+ *
+ * @param cur valid cursor
+ */
+static inline void **bptree_cursor_val(const struct bptree_cursor *cur) {
+    return &cur->leaf->vals[cur->pos];
+}
+
+/**
+ * Iterate over the entries of a tree in key order.
+ *
+ * @param cur struct bptree_cursor pointer to use as a loop cursor
+ * @param tree the tree
+ */
+#define bptree_for_each(cur, tree) \
+    for (bptree_first(tree, cur); (cur)->leaf; bptree_next(cur))
+
+/**
+ * Iterate backwards over the entries of a tree.
+ *
+ * @param cur struct bptree_cursor pointer to use as a loop cursor
+ * @param tree the tree
+ */
+#define bptree_for_each_prev(cur, tree) \
+    for (bptree_last(tree, cur); (cur)->leaf; bptree_prev(cur))
+
+/**
+ * Iterate over the entries with keys in [lo, hi] in key order.
+ *
+ * @param cur struct bptree_cursor pointer to use as a loop cursor
+ * @param tree the tree
+ * @param lo lowest key
+ * @param hi highest key
+ */
+#define bptree_for_each_range(cur, tree, lo, hi) \
+    for (bptree_seek(tree, lo, cur); \
+         (cur)->leaf && bptree_cursor_key(cur) <= (hi); \
+         bptree_next(cur))
+
+#endif // BPTREE_H_
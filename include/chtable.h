@@ -0,0 +1,196 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHTABLE_H_
+#define CHTABLE_H_
+
+#include "atomic.h"
+#include "htable.h"
+#include "rculist.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Concurrent hash table.
+ *
+ * Readers look entries up without taking any lock inside a read-side
+ * critical section delimited by chtable_read_lock() and
+ * chtable_read_unlock(). Writers serialize on one of CHTABLE_LOCK_STRIPES
+ * locks selected by the key hash. Since the bucket count is always a
+ * power of two no smaller than the number of stripes, a stripe covers the
+ * same buckets before and after a resize.
+ *
+ * The table is resized cooperatively: once a resize starts, every writer
+ * migrates a few old buckets under the stripe lock of those buckets. Moves
+ * are bracketed by a per-stripe sequence count and readers which miss
+ * while a move was in progress retry.
+ *
+ * Removed entries must not be freed nor reused before chtable_synchronize()
+ * returns, which waits for all read-side critical sections in progress.
+ * Writers never wait for readers themselves, so they may be called from
+ * within a read-side critical section. The bucket array left over by a
+ * resize is freed by the next chtable_synchronize() or chtable_destroy().
+ */
+
+/** Number of writer locks */
+#define CHTABLE_LOCK_STRIPES 64
+/** Number of reader counter slots */
+#define CHTABLE_READER_SLOTS 64
+/** Grow the table once the average chain length exceeds this value */
+#define CHTABLE_GROW_LOAD 2
+/** Number of old buckets migrated by each writer while resizing */
+#define CHTABLE_REHASH_STEP 1
+
+#define CHTABLE_CACHELINE_SIZE 64
+
+/** Bucket array */
+struct chtable_buckets {
+  /** Number of buckets */
+  size_t size;
+  /** Index of the next bucket to be migrated */
+  atomic_size_t rehash_idx;
+  /** Number of buckets already migrated */
+  atomic_size_t rehash_done;
+  /** Next array waiting to be freed once migrated */
+  struct chtable_buckets *retired_next;
+  /** Heads of list of entries in the buckets */
+  struct hlist_head heads[];
+};
+
+/** Writer lock covering a stripe of buckets */
+struct chtable_stripe {
+  /** Lock serializing writers */
+  pthread_mutex_t lock;
+  /** Sequence count, odd while entries are moved between buckets */
+  atomic_uint seq;
+  /** Number of entries in the stripe */
+  size_t count;
+} __attribute__((aligned(CHTABLE_CACHELINE_SIZE)));
+
+/** Readers in each of the two grace period phases */
+struct chtable_readers {
+  atomic_ulong count[2];
+} __attribute__((aligned(CHTABLE_CACHELINE_SIZE)));
+
+/** Concurrent hash table containing buckets full of entries */
+struct chtable {
+  /** Buckets containing table elements */
+  struct chtable_buckets *bucks;
+  /** Buckets being migrated while the table is resized, NULL otherwise */
+  struct chtable_buckets *old_bucks;
+  /** Migrated bucket arrays, freed by the next grace period */
+  atomic_uintptr_t retired;
+  /** Grace period counter, its low bit selects the reader phase */
+  atomic_uint epoch;
+  /** Serializes resizes */
+  pthread_mutex_t resize_lock;
+  /** Serializes grace periods */
+  pthread_mutex_t sync_lock;
+  /** Writer locks */
+  struct chtable_stripe stripes[CHTABLE_LOCK_STRIPES];
+  /** Reader counters */
+  struct chtable_readers readers[CHTABLE_READER_SLOTS];
+};
+
+#define chtable_which_stripe(hash) ((hash) & (CHTABLE_LOCK_STRIPES - 1))
+#define chtable_which_bucket(bucks, hash) ((hash) & ((bucks)->size - 1))
+
+/* Externals are commented with implementation */
+extern int chtable_init(struct chtable *table);
+extern int chtable_init_n(struct chtable *table, size_t n);
+extern void chtable_destroy(struct chtable *table);
+
+extern unsigned chtable_read_lock(struct chtable *table);
+extern void chtable_read_unlock(struct chtable *table, unsigned token);
+extern void chtable_synchronize(struct chtable *table);
+
+extern void chtable_add(struct chtable *table, struct htable_entry *entry, void *key, size_t len);
+extern struct htable_entry *chtable_del_key(struct chtable *table, const void *key, size_t len);
+extern struct htable_entry *chtable_del_entry(struct chtable *table, struct htable_entry *entry);
+extern int chtable_resize(struct chtable *table, size_t size);
+extern size_t chtable_count(struct chtable *table);
+
+/**
+ * Look for the key in a single bucket without locking.
+ *
+ * @param head bucket to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key
+ */
+static inline struct htable_entry *__chtable_find_bucket(struct hlist_head *head,
+    const void *key, size_t len, unsigned hash) {
+  struct htable_entry *e;
+  struct hlist_node *n;
+
+  hlist_for_each_entry_rcu(e, n, head, node) {
+    if (htable_entry_match(e, hash, key, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * Must be called from within a read-side critical section, the returned
+ * entry remains valid until the section ends.
+ *
+ * @param table the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct htable_entry *chtable_find(struct chtable *table, const void *key, size_t len) {
+  unsigned hash = jhash(key, len, 0);
+  struct chtable_stripe *stripe = &table->stripes[chtable_which_stripe(hash)];
+  struct chtable_buckets *bucks, *old;
+  struct htable_entry *e;
+  unsigned seq;
+
+  do {
+    while ((seq = atomic_load_explicit(&stripe->seq, memory_order_acquire)) & 1) {
+      continue;
+    }
+
+    bucks = rcu_dereference(table->bucks);
+    if ((e = __chtable_find_bucket(&bucks->heads[chtable_which_bucket(bucks, hash)], key, len, hash))) {
+      return e;
+    }
+    old = rcu_dereference(table->old_bucks);
+    if (old && (e = __chtable_find_bucket(&old->heads[chtable_which_bucket(old, hash)], key, len, hash))) {
+      return e;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+  } while (atomic_load_explicit(&stripe->seq, memory_order_relaxed) != seq);
+
+  return NULL;
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define chash_find_entry(table, key, len, type, member) ({ \
+    struct htable_entry *e = chtable_find((table), (key), (len)); \
+    (type *)(e ? hash_entry(e, type, member) : NULL); })
+
+#endif // CHTABLE_H_
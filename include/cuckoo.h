@@ -0,0 +1,536 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CUCKOO_H_
+#define CUCKOO_H_
+
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Bucketized cuckoo hash table.
+ *
+ * Every key has two candidate buckets of CUCKOO_WAYS slots each, picked by
+ * two jhash() functions with different initial values. A lookup examines
+ * these two buckets and the stash and nothing else, so its cost is bounded
+ * whatever the table contents. Each slot keeps an 8-bit tag of the key hash
+ * next to the entry pointer, only entries with a matching tag are compared.
+ *
+ * Adding an entry to two full buckets evicts an entry from one of them into
+ * its alternate bucket, possibly evicting another one, for up to
+ * CUCKOO_MAX_KICKS moves. An entry left over after that is kept in the
+ * stash, a small array searched by every lookup while it is not empty, and
+ * the table grows once the stash is full. Defining CUCKOO_STASH_SIZE to 0
+ * before including this header removes the stash, the table then grows as
+ * soon as the kicks run out.
+ */
+
+/** Number of slots per bucket */
+#define CUCKOO_WAYS 4
+/** Default number of buckets */
+#define CUCKOO_NUM_BUCKETS 4
+/** Number of entries moved by an insertion before it gives up */
+#define CUCKOO_MAX_KICKS 64
+#ifndef CUCKOO_STASH_SIZE
+/** Number of entries which can be kept outside of the buckets */
+#define CUCKOO_STASH_SIZE 4
+#endif
+/** Initial value of the first hash function */
+#define CUCKOO_INITVAL1 0
+/** Initial value of the second hash function */
+#define CUCKOO_INITVAL2 0x9e3779b9
+
+/** Hash table entry identified by key */
+struct cuckoo_entry {
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Results of both hash functions applied to key */
+  unsigned hash[2];
+};
+
+/** Hash table bucket */
+struct cuckoo_bucket {
+  /** Tags of the entries in the slots */
+  uint8_t tags[CUCKOO_WAYS];
+  /** Slots holding entries, NULL when free */
+  struct cuckoo_entry *slots[CUCKOO_WAYS];
+};
+
+/** Cuckoo hash table */
+struct cuckoo {
+  /** Buckets containing table elements */
+  struct cuckoo_bucket *bucks;
+  /** Number of allocated buckets */
+  size_t size;
+  /** Number of entries in the table, including the stash */
+  size_t count;
+#if CUCKOO_STASH_SIZE > 0
+  /** Entries which did not fit in their buckets */
+  struct cuckoo_entry *stash[CUCKOO_STASH_SIZE];
+  /** Number of entries in the stash */
+  size_t stash_count;
+#endif
+};
+
+#define cuckoo_which_bucket(table, hash) ((hash) & ((table)->size - 1))
+#define cuckoo_tag(entry) ((uint8_t)((entry)->hash[0] >> 24))
+
+/** Number of slots visited by cuckoo_for_each(), including the stash */
+#define cuckoo_num_slots(table) ((table)->size * CUCKOO_WAYS + CUCKOO_STASH_SIZE)
+
+/**
+ * Get the two candidate buckets of an entry.
+ *
+ * The buckets are distinct even if both hashes map to the same bucket.
+ *
+ * @param table hash table
+ * @param entry hash entry, with hashes set
+ * @param b receives the bucket indexes
+ */
+static inline void __cuckoo_buckets(const struct cuckoo *table, const struct cuckoo_entry *entry, size_t b[2]) {
+  b[0] = cuckoo_which_bucket(table, entry->hash[0]);
+  b[1] = cuckoo_which_bucket(table, entry->hash[1]);
+  if (b[1] == b[0]) {
+    b[1] ^= 1;
+  }
+}
+
+/**
+ * Get the entry in a slot, counting buckets first and then the stash.
+ *
+ * @param table hash table
+ * @param i slot index, below cuckoo_num_slots()
+ * @return entry or NULL if the slot is not used
+ */
+static inline struct cuckoo_entry *cuckoo_slot(const struct cuckoo *table, size_t i) {
+  if (i < table->size * CUCKOO_WAYS) {
+    return table->bucks[i / CUCKOO_WAYS].slots[i % CUCKOO_WAYS];
+  }
+#if CUCKOO_STASH_SIZE > 0
+  i -= table->size * CUCKOO_WAYS;
+  return i < table->stash_count ? table->stash[i] : NULL;
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * Initialize new hash table entry.
+ */
+static inline void INIT_CUCKOO_ENTRY(struct cuckoo_entry *entry, void *key, size_t len) {
+  entry->key = key;
+  entry->len = len;
+  entry->hash[0] = jhash(key, len, CUCKOO_INITVAL1);
+  entry->hash[1] = jhash(key, len, CUCKOO_INITVAL2);
+}
+
+/**
+ * Initialize new table of given size.
+ *
+ * @param table hash table
+ * @param n expected number of entries
+ */
+static inline int cuckoo_init_n(struct cuckoo *table, size_t n) {
+  if (!table) {
+    return -1;
+  }
+
+  // Aim for a load factor of at most one half
+  size_t size = CUCKOO_NUM_BUCKETS;
+  while (size * CUCKOO_WAYS < n * 2) {
+    size <<= 1;
+  }
+
+  table->bucks = (struct cuckoo_bucket *)calloc(size, sizeof(struct cuckoo_bucket));
+  if (!table->bucks) {
+    return -1;
+  }
+  table->size = size;
+  table->count = 0;
+#if CUCKOO_STASH_SIZE > 0
+  table->stash_count = 0;
+#endif
+
+  return 0;
+}
+
+/**
+ * Initialize new hash table.
+ *
+ * @param table hash table
+ */
+static inline int cuckoo_init(struct cuckoo *table) {
+  return cuckoo_init_n(table, 0);
+}
+
+/**
+ * Destroy hash table.
+ *
+ * @param table hash table
+ */
+static inline void cuckoo_destroy(struct cuckoo *table) {
+  if (table && table->bucks) {
+    free(table->bucks);
+    table->bucks = NULL;
+  }
+}
+
+/**
+ * Put an entry into a free slot of a bucket.
+ *
+ * @param bucket hash table bucket
+ * @param entry hash entry
+ * @return 0 on success, -1 if the bucket is full
+ */
+static inline int __cuckoo_bucket_add(struct cuckoo_bucket *bucket, struct cuckoo_entry *entry) {
+  for (int i = 0; i < CUCKOO_WAYS; ++i) {
+    if (!bucket->slots[i]) {
+      bucket->tags[i] = cuckoo_tag(entry);
+      bucket->slots[i] = entry;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Put an entry into one of its buckets, evicting other entries if needed.
+ *
+ * The entry count is not updated.
+ *
+ * @param table hash table
+ * @param entry hash entry
+ * @return NULL on success, otherwise the entry which could not be placed,
+ *   which may be another entry than the one added
+ */
+static inline struct cuckoo_entry *__cuckoo_place(struct cuckoo *table, struct cuckoo_entry *entry) {
+  size_t b[2], cur;
+
+  __cuckoo_buckets(table, entry, b);
+  if (__cuckoo_bucket_add(&table->bucks[b[0]], entry) == 0 ||
+      __cuckoo_bucket_add(&table->bucks[b[1]], entry) == 0) {
+    return NULL;
+  }
+
+  cur = b[0];
+  for (unsigned kick = 0; kick < CUCKOO_MAX_KICKS; ++kick) {
+    // Vary the victim slot so that evictions do not cycle between two entries
+    struct cuckoo_bucket *bucket = &table->bucks[cur];
+    int i = (entry->hash[1] + kick) % CUCKOO_WAYS;
+    struct cuckoo_entry *victim = bucket->slots[i];
+
+    bucket->tags[i] = cuckoo_tag(entry);
+    bucket->slots[i] = entry;
+    entry = victim;
+
+    __cuckoo_buckets(table, entry, b);
+    cur = b[0] == cur ? b[1] : b[0];
+    if (__cuckoo_bucket_add(&table->bucks[cur], entry) == 0) {
+      return NULL;
+    }
+  }
+
+  return entry;
+}
+
+/**
+ * Move all entries into a bucket array of the given size.
+ *
+ * @param table hash table
+ * @param size new number of buckets, must be a power of two
+ * @return 0 on success, -1 otherwise
+ */
+static inline int cuckoo_resize(struct cuckoo *table, size_t size) {
+  struct cuckoo old = *table;
+
+  if (size < 2 || size * CUCKOO_WAYS + CUCKOO_STASH_SIZE < table->count) {
+    return -1;
+  }
+
+  table->bucks = (struct cuckoo_bucket *)calloc(size, sizeof(struct cuckoo_bucket));
+  if (!table->bucks) {
+    *table = old;
+    return -1;
+  }
+  table->size = size;
+#if CUCKOO_STASH_SIZE > 0
+  table->stash_count = 0;
+#endif
+
+  for (size_t i = 0; i < cuckoo_num_slots(&old); ++i) {
+    struct cuckoo_entry *e = cuckoo_slot(&old, i);
+    if (e && (e = __cuckoo_place(table, e))) {
+#if CUCKOO_STASH_SIZE > 0
+      if (table->stash_count < CUCKOO_STASH_SIZE) {
+        table->stash[table->stash_count++] = e;
+        continue;
+      }
+#endif
+      // Entries are still where they were in the old array
+      free(table->bucks);
+      *table = old;
+      return -1;
+    }
+  }
+
+  free(old.bucks);
+
+  return 0;
+}
+
+/**
+ * Add a new entry into hash table.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+static inline void cuckoo_add(struct cuckoo *table, struct cuckoo_entry *entry, void *key, size_t len) {
+  INIT_CUCKOO_ENTRY(entry, key, len);
+
+  while ((entry = __cuckoo_place(table, entry))) {
+#if CUCKOO_STASH_SIZE > 0
+    if (table->stash_count < CUCKOO_STASH_SIZE) {
+      table->stash[table->stash_count++] = entry;
+      break;
+    }
+#endif
+    // The displaced entry is outside the table, which grows without it
+    size_t size = table->size;
+    int ret;
+    do {
+      size <<= 1;
+      ret = cuckoo_resize(table, size);
+    } while (ret < 0 && size < SIZE_MAX / 2 / sizeof(struct cuckoo_bucket));
+    assert(ret == 0);
+    (void)ret;
+  }
+
+  table->count++;
+}
+
+/**
+ * Find the slot of an entry in a bucket.
+ *
+ * @param bucket hash table bucket
+ * @param tag tag of the key hash
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the first hash of the key
+ * @return slot index, or -1 if the key is not present
+ */
+static inline int __cuckoo_bucket_find(const struct cuckoo_bucket *bucket, uint8_t tag,
+    const void *key, size_t len, unsigned hash) {
+  for (int i = 0; i < CUCKOO_WAYS; ++i) {
+    const struct cuckoo_entry *e = bucket->slots[i];
+    if (bucket->tags[i] == tag && e && e->hash[0] == hash &&
+        e->len == len && memcmp(e->key, key, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Find the slot holding the key.
+ *
+ * @param table hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return slot index as taken by cuckoo_slot(), or cuckoo_num_slots() if
+ *   the key is not present
+ */
+static inline size_t __cuckoo_find_slot(const struct cuckoo *table, const void *key, size_t len) {
+  struct cuckoo_entry probe;
+  size_t b[2];
+  int i;
+
+  probe.hash[0] = jhash(key, len, CUCKOO_INITVAL1);
+  probe.hash[1] = jhash(key, len, CUCKOO_INITVAL2);
+  __cuckoo_buckets(table, &probe, b);
+
+  for (int k = 0; k < 2; ++k) {
+    i = __cuckoo_bucket_find(&table->bucks[b[k]], cuckoo_tag(&probe), key, len, probe.hash[0]);
+    if (i >= 0) {
+      return b[k] * CUCKOO_WAYS + i;
+    }
+  }
+
+#if CUCKOO_STASH_SIZE > 0
+  for (size_t s = 0; s < table->stash_count; ++s) {
+    const struct cuckoo_entry *e = table->stash[s];
+    if (e->hash[0] == probe.hash[0] && e->len == len && memcmp(e->key, key, len) == 0) {
+      return table->size * CUCKOO_WAYS + s;
+    }
+  }
+#endif
+
+  return cuckoo_num_slots(table);
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param table the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct cuckoo_entry *cuckoo_find(const struct cuckoo *table, const void *key, size_t len) {
+  size_t i = __cuckoo_find_slot(table, key, len);
+  return i < cuckoo_num_slots(table) ? cuckoo_slot(table, i) : NULL;
+}
+
+/**
+ * Empty a slot and move stashed entries into the buckets if they fit.
+ *
+ * @param table hash table
+ * @param i slot index as taken by cuckoo_slot()
+ */
+static inline void __cuckoo_del_slot(struct cuckoo *table, size_t i) {
+  if (i < table->size * CUCKOO_WAYS) {
+    table->bucks[i / CUCKOO_WAYS].slots[i % CUCKOO_WAYS] = NULL;
+  }
+#if CUCKOO_STASH_SIZE > 0
+  else {
+    i -= table->size * CUCKOO_WAYS;
+    table->stash[i] = table->stash[--table->stash_count];
+  }
+
+  for (size_t s = 0; s < table->stash_count; ) {
+    struct cuckoo_entry *e = table->stash[s];
+    size_t b[2];
+
+    __cuckoo_buckets(table, e, b);
+    if (__cuckoo_bucket_add(&table->bucks[b[0]], e) == 0 ||
+        __cuckoo_bucket_add(&table->bucks[b[1]], e) == 0) {
+      table->stash[s] = table->stash[--table->stash_count];
+    } else {
+      s++;
+    }
+  }
+#endif
+  table->count--;
+}
+
+/**
+ * Remove entry with the given key from hash table.
+ *
+ * @param table the hash table to remove entry from
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if the key was not found
+ */
+static inline struct cuckoo_entry *cuckoo_del_key(struct cuckoo *table, const void *key, size_t len) {
+  size_t i = __cuckoo_find_slot(table, key, len);
+  struct cuckoo_entry *entry = NULL;
+
+  if (i < cuckoo_num_slots(table)) {
+    entry = cuckoo_slot(table, i);
+    __cuckoo_del_slot(table, i);
+  }
+  return entry;
+}
+
+/**
+ * Remove entry previously added to the hash table.
+ *
+ * @param table the hash table to remove entry from
+ * @param entry the hash entry
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct cuckoo_entry *cuckoo_del_entry(struct cuckoo *table, struct cuckoo_entry *entry) {
+  size_t b[2];
+
+  __cuckoo_buckets(table, entry, b);
+  for (int k = 0; k < 2; ++k) {
+    for (int i = 0; i < CUCKOO_WAYS; ++i) {
+      if (table->bucks[b[k]].slots[i] == entry) {
+        __cuckoo_del_slot(table, b[k] * CUCKOO_WAYS + i);
+        return entry;
+      }
+    }
+  }
+
+#if CUCKOO_STASH_SIZE > 0
+  for (size_t s = 0; s < table->stash_count; ++s) {
+    if (table->stash[s] == entry) {
+      __cuckoo_del_slot(table, table->size * CUCKOO_WAYS + s);
+      return entry;
+    }
+  }
+#endif
+
+  return NULL;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the hash table pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define cuckoo_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define cuckoo_find_entry(table, key, len, type, member) ({ \
+    struct cuckoo_entry *e = cuckoo_find((table), (key), (len)); \
+    (type *)(e ? cuckoo_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over hash table elements.
+ *
+ * Entries may be removed from the table while iterating, which may move a
+ * stashed entry to a slot already visited.
+ *
+ * @param pos struct cuckoo entry to use as a loop counter
+ * @param table your table
+ */
+#define cuckoo_for_each(pos, table) \
+  for (size_t i = 0; i < cuckoo_num_slots(table); ++i) \
+    for (pos = cuckoo_slot((table), i); pos; pos = NULL)
+
+/**
+ * Iterate over hash table elements of given type.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define cuckoo_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < cuckoo_num_slots(table); ++i) \
+    for (pos = cuckoo_slot((table), i); \
+         pos && ({ tpos = cuckoo_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = NULL)
+
+#endif // CUCKOO_H_
@@ -18,9 +18,12 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include <sys/uio.h>
+
 /*
  * Knuth recommends primes in approximately golden ratio to the maximum
  * integer representable by a machine word for multiplicative _hashing.
@@ -66,6 +69,23 @@ static inline uint64_t hash_64(uint64_t val, unsigned int bits) {
   return hash >> (64 - bits);
 }
 
+/**
+ * Mix all bits of a 64-bit value, the murmur3 64-bit finalizer.
+ *
+ * Unlike hash_64(), every input bit affects every output bit, so keys
+ * differing only in their low or high bits are spread all the same.
+ *
+ * @param val value to mix
+ */
+static inline uint64_t hash_mix64(uint64_t val) {
+  val ^= val >> 33;
+  val *= 0xff51afd7ed558ccdULL;
+  val ^= val >> 33;
+  val *= 0xc4ceb9fe1a85ec53ULL;
+  val ^= val >> 33;
+  return val;
+}
+
 static inline uint32_t hash_32(uint32_t val, unsigned int bits) {
   uint32_t hash = val * GOLDEN_RATIO_PRIME_32;
 
@@ -79,7 +99,7 @@ static inline unsigned long hash_ptr(const void *ptr, unsigned int bits) {
 
 static inline unsigned long hash_internal(const void *data, unsigned int len) {
   unsigned char *p = (unsigned char *)data;
-  unsigned char *e = *p + len;
+  unsigned char *e = p + len;
   uint32_t h = 0xfeedbeef;
 
   while (p < e) {
@@ -90,4 +110,45 @@ static inline unsigned long hash_internal(const void *data, unsigned int len) {
   return h;
 }
 
+/*
+ * Byte string hashes.
+ *
+ * hash_bytes() is the general purpose hash for keys of any length, a
+ * 64-bit hash in the style of wyhash which consumes 48 bytes per round
+ * in three independent multiply chains. hash_crc32c() computes the
+ * Castagnoli CRC, with the SSE4.2 crc32 instruction when the processor
+ * supports it and slicing-by-8 tables otherwise.
+ *
+ * Keys split across several buffers are hashed without copying them with
+ * the streaming interface, or the _iov variants for scatter lists.
+ */
+
+/** State of hash_bytes() computed over several fragments */
+struct hash_state {
+  /** Multiply chains */
+  uint64_t seed, s1, s2;
+  /** Total length of the key */
+  size_t len;
+  /** Number of bytes consumed by rounds */
+  size_t done;
+  /** End of the 48 and 16 byte rounds */
+  size_t end48, end;
+  /** Number of buffered bytes */
+  size_t buflen;
+  /** Bytes of a round split across fragments, or the whole short key */
+  uint8_t buf[48];
+  /** Last 16 bytes seen, read by the final step */
+  uint8_t last[16];
+};
+
+/* Externals are commented with implementation */
+extern uint64_t hash_bytes(uint64_t seed, const void *data, size_t len);
+extern void hash_bytes_init(struct hash_state *state, uint64_t seed, size_t len);
+extern void hash_bytes_update(struct hash_state *state, const void *data, size_t len);
+extern uint64_t hash_bytes_final(struct hash_state *state);
+extern uint64_t hash_bytes_iov(uint64_t seed, const struct iovec *iov, int iovcnt);
+
+extern uint32_t hash_crc32c(uint32_t crc, const void *data, size_t len);
+extern uint32_t hash_crc32c_iov(uint32_t crc, const struct iovec *iov, int iovcnt);
+
 #endif // HASH_H
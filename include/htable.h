@@ -18,8 +18,11 @@
 #ifndef HTABLE_H_
 #define HTABLE_H_
 
+#include "bloom.h"
+#include "hash.h"
 #include "jhash.h"
 #include "hlist.h"
+#include "hugepage.h"
 #include "kernel.h"
 #include "log2.h"
 
@@ -29,28 +32,25 @@
 
 #include <sys/mman.h>
 
-#define BLOOM_BIT_LENGTH 8
-
-#define bloom_init(bitvect) ({ \
-    (bitvect) = (uint8_t *)malloc((1ULL << BLOOM_BIT_LENGTH) / BITS_PER_BYTE); \
-    assert((bitvect)); \
-    memset((bitvect), 0, (1ULL << BLOOM_BIT_LENGTH) / BITS_PER_BYTE); })
-#define bloom_finit(bitvect) free((bitvect))
-
-#define bloom_set_bit(bits, idx) \
-  (bits[(idx) / BITS_PER_BYTE] |= (1U << ((idx) % BITS_PER_BYTE)))
-#define bloom_test_bit(bits, idx) \
-  (bits[(idx) / BITS_PER_BYTE] & (1U << ((idx) % BITS_PER_BYTE)))
-
-#define bloom_set(bitvect, hash) \
-  bloom_set_bit((bitvect), (hash & (uint32_t)((1ULL << BLOOM_BIT_LENGTH) - 1)))
-#define bloom_test(bitvect, hash) \
-  bloom_test_bit((bitvect), (hash & (uint32_t)((1ULL << BLOOM_BIT_LENGTH) - 1)))
-
 /** Default number of buckets */
 #define HASH_NUM_BUCKETS 16
 /** Expand when bucket count reach threshold */
 #define HASH_BUCKET_THRESH 10
+/** Grow the table once the average chain length exceeds this value */
+#define HTABLE_GROW_LOAD 2
+/** Shrink the table once fewer than one in this many buckets is used */
+#define HTABLE_SHRINK_LOAD 8
+/** Number of old buckets migrated by each table operation while resizing */
+#define HTABLE_REHASH_STEP 1
+/** False positive rate of the table Bloom filter */
+#define HTABLE_BLOOM_FPR 0.01
+/** Number of lookups pipelined together by htable_find_batch */
+#define HTABLE_BATCH_SIZE 32
+/** Number of chain length histogram slots, the last one counts longer chains */
+#define HTABLE_STATS_HIST 16
+
+/** Allocate bucket arrays with hugepage_alloc() */
+#define HTABLE_HUGE_PAGES 0x1
 
 /** Hash table entry identified by key */
 struct htable_entry {
@@ -74,6 +74,36 @@ struct htable_bucket {
   unsigned expand_mult;
 };
 
+/** Lookup counters, maintained when HTABLE_STATS is defined */
+struct htable_counters {
+  /** Number of lookups which found the key */
+  unsigned long hits;
+  /** Number of lookups which did not find the key */
+  unsigned long misses;
+  /** Number of entries compared against looked up keys */
+  unsigned long probes;
+};
+
+/** Snapshot of the state of a hash table, see htable_get_stats() */
+struct htable_stats {
+  /** Number of buckets */
+  size_t size;
+  /** Number of entries */
+  size_t count;
+  /** Average number of entries per bucket */
+  double load;
+  /** Number of buckets holding chains of each length */
+  size_t chains[HTABLE_STATS_HIST];
+  /** Length of the longest chain */
+  size_t max_chain;
+  /** Fraction of bits set in the Bloom filter */
+  double bloom_fill;
+  /** Lookup counters, zero unless HTABLE_STATS is defined */
+  struct htable_counters counters;
+  /** Average number of entries compared per lookup */
+  double avg_probes;
+};
+
 /** Hash table containing buckets full of entries */
 struct htable {
   /** Buckets containing table elements */
@@ -82,11 +112,95 @@ struct htable {
   size_t size;
   /** Number of entries in the table */
   size_t count;
-  /** Bloom filter bit vector */
-  uint8_t *bitvect;
+  /** Bloom filter of entries in the bucket array */
+  struct bloom bloom;
+  /** Buckets being migrated while the table is resized, NULL otherwise */
+  struct hlist_head *old_bucks;
+  /** Number of buckets in the old bucket array */
+  size_t old_size;
+  /** Index of the next old bucket to be migrated */
+  size_t rehash_idx;
+  /** Bloom filter of entries in the old bucket array */
+  struct bloom old_bloom;
+  /** Hash function applied to keys, jhash when NULL */
+  unsigned (*hash)(const void *key, size_t len, unsigned seed);
+  /** Seed passed to the hash function */
+  unsigned seed;
+  /** HTABLE_* allocation flags */
+  unsigned flags;
+#ifdef HTABLE_STATS
+  /** Lookup counters */
+  struct htable_counters counters;
+#endif
 };
 
+/*
+ * Lookup counters are only maintained when HTABLE_STATS is defined before
+ * including this header, otherwise they compile to nothing.
+ */
+#ifdef HTABLE_STATS
+#define htable_count_stat(table, counter, n) ((table)->counters.counter += (n))
+#else
+#define htable_count_stat(table, counter, n) ((void)0)
+#endif
+
 #define htable_which_bucket(table, hash) ((hash) & ((table)->size - 1))
+#define htable_which_old_bucket(table, hash) ((hash) & ((table)->old_size - 1))
+
+/** Tests whether the table is in the middle of an incremental resize */
+#define htable_rehashing(table) ((table)->old_bucks != NULL)
+
+/**
+ * Hash key with the table hash function.
+ *
+ * The default jhash is called directly so that it can be inlined.
+ *
+ * @param table hash table
+ * @param key the pointer to key
+ * @param len the key length
+ */
+#define htable_hash(table, key, len) \
+  ((table)->hash ? (table)->hash((key), (len), (table)->seed) : jhash((key), (len), (table)->seed))
+
+/**
+ * Hash a 64-bit integer key into a bucket hash.
+ *
+ * Buckets are selected by the low bits of the hash, so every one of them
+ * has to depend on every key bit. A multiplication only carries key bits
+ * upwards, so the key goes through the murmur3 64-bit finalizer instead.
+ * The seed is spread over the whole word and mixed in before it, so keys
+ * colliding under one seed are scattered under another.
+ *
+ * @param key the key
+ * @param seed the table seed
+ */
+static inline unsigned __htable_hash_int(uint64_t key, unsigned seed) {
+  return hash_mix64(key ^ (seed * 0x9e3779b97f4a7c15ULL));
+}
+
+/**
+ * Hash function for tables keyed by 32-bit integers.
+ *
+ * @param key the pointer to a uint32_t key
+ * @param len the key length, unused
+ * @param seed the table seed
+ */
+static inline unsigned htable_hash_u32(const void *key, size_t len, unsigned seed) {
+  (void)len;
+  return __htable_hash_int(*(const uint32_t *)key, seed);
+}
+
+/**
+ * Hash function for tables keyed by 64-bit integers.
+ *
+ * @param key the pointer to a uint64_t key
+ * @param len the key length, unused
+ * @param seed the table seed
+ */
+static inline unsigned htable_hash_u64(const void *key, size_t len, unsigned seed) {
+  (void)len;
+  return __htable_hash_int(*(const uint64_t *)key, seed);
+}
 
 /**
  * Initialize new hash table entry.
@@ -98,25 +212,90 @@ static inline void INIT_HTABLE_ENTRY(struct htable_entry *entry, void *key, size
 }
 
 /**
- * Initialize new hash table.
+ * Hash function for tables with long keys.
+ *
+ * @param key the pointer to key
+ * @param len the key length
+ * @param seed the table seed
+ */
+static inline unsigned htable_hash_bytes(const void *key, size_t len, unsigned seed) {
+  return (unsigned)hash_bytes(seed, key, len);
+}
+
+/**
+ * Allocate an array of empty buckets.
+ *
+ * @param flags HTABLE_* allocation flags
+ * @param size number of buckets
+ * @return bucket array or NULL
+ */
+static inline struct hlist_head *__htable_alloc_bucks(unsigned flags, size_t size) {
+  struct hlist_head *bucks;
+
+  if (flags & HTABLE_HUGE_PAGES) {
+    // Mapped memory is zeroed, which is an empty bucket
+    return (struct hlist_head *)hugepage_alloc(sizeof(struct hlist_head) * size);
+  }
+
+  bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * size);
+  if (bucks) {
+    for (size_t i = 0; i < size; ++i) {
+      INIT_HLIST_HEAD(&bucks[i]);
+    }
+  }
+  return bucks;
+}
+
+/**
+ * Free a bucket array allocated by __htable_alloc_bucks().
+ *
+ * @param flags HTABLE_* allocation flags
+ * @param bucks bucket array, may be NULL
+ * @param size number of buckets
+ */
+static inline void __htable_free_bucks(unsigned flags, struct hlist_head *bucks, size_t size) {
+  if (flags & HTABLE_HUGE_PAGES) {
+    hugepage_free(bucks, sizeof(struct hlist_head) * size);
+  } else {
+    free(bucks);
+  }
+}
+
+/**
+ * Initialize new table of given size with allocation flags.
+ *
+ * With HTABLE_HUGE_PAGES, bucket arrays of large tables are placed in huge
+ * pages, so lookups into a table of millions of buckets do not miss the TLB
+ * on every access. Small bucket arrays then take whole pages.
  *
  * @param table hash table
+ * @param n aproximate size, rounded up to a power of two
+ * @param flags HTABLE_* allocation flags
  */
-static inline int htable_init(struct htable *table) {
+static inline int htable_init_flags(struct htable *table, size_t n, unsigned flags) {
   if (!table) {
     return -1;
   }
 
-  table->size = HASH_NUM_BUCKETS;
-  table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * table->size);
+  table->flags = flags;
+  table->size = n > 1 ? roundup_pow_of_two(n) : HASH_NUM_BUCKETS;
+  table->bucks = __htable_alloc_bucks(flags, table->size);
   assert(table->bucks);
 
-  for (int i = 0; i < table->size; ++i) {
-    INIT_HLIST_HEAD(&table->bucks[i]);
-  }
-
   table->count = 0;
-  bloom_init(table->bitvect);
+  table->old_bucks = NULL;
+  table->old_size = 0;
+  table->rehash_idx = 0;
+  table->old_bloom.bits = NULL;
+  table->hash = NULL;
+  table->seed = 0;
+#ifdef HTABLE_STATS
+  memset(&table->counters, 0, sizeof(table->counters));
+#endif
+
+  int ret = bloom_init(&table->bloom, table->size * HTABLE_GROW_LOAD, HTABLE_BLOOM_FPR);
+  assert(ret == 0);
+  (void)ret;
 
   return 0;
 }
@@ -125,23 +304,42 @@ static inline int htable_init(struct htable *table) {
  * Initialize new table of given size.
  *
  * @param table hash table
- * @param n aproximate size
+ * @param n aproximate size, rounded up to a power of two
  */
 static inline int htable_init_n(struct htable *table, size_t n) {
-  if (!table) {
-    return -1;
-  }
+  return htable_init_flags(table, n, 0);
+}
 
-  table->size = n > 0 ? n : HASH_BUCKET_THRESH;
-  table->bucks = (struct hlist_head *)malloc(sizeof(struct hlist_head) * table->size);
-  assert(table->bucks);
+/**
+ * Initialize new hash table.
+ *
+ * @param table hash table
+ */
+static inline int htable_init(struct htable *table) {
+  return htable_init_n(table, HASH_NUM_BUCKETS);
+}
 
-  for (int i = 0; i < table->size; ++i) {
-    INIT_HLIST_HEAD(&table->bucks[i]);
+/**
+ * Initialize new table of given size with a custom hash function.
+ *
+ * Integer keyed tables can use htable_hash_u32() or htable_hash_u64(),
+ * tables with long keys htable_hash_bytes(). A random seed changes which
+ * keys collide, but none of these functions is a keyed hash designed to
+ * resist an adversary who can observe the table.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to a power of two
+ * @param hash hash function, NULL for jhash
+ * @param seed seed passed to the hash function
+ */
+static inline int htable_init_hash(struct htable *table, size_t n,
+    unsigned (*hash)(const void *key, size_t len, unsigned seed), unsigned seed) {
+  if (htable_init_n(table, n) < 0) {
+    return -1;
   }
-  table->count = 0;
-  bloom_init(table->bitvect);
 
+  table->hash = hash;
+  table->seed = seed;
   return 0;
 }
 
@@ -152,9 +350,139 @@ static inline int htable_init_n(struct htable *table, size_t n) {
  */
 static inline void htable_destroy(struct htable *table) {
   if (table && table->bucks) {
-    free(table->bucks);
+    __htable_free_bucks(table->flags, table->bucks, table->size);
+  }
+  if (table && table->old_bucks) {
+    __htable_free_bucks(table->flags, table->old_bucks, table->old_size);
+  }
+  bloom_destroy(&table->bloom);
+  bloom_destroy(&table->old_bloom);
+}
+
+/**
+ * Migrate up to @p n non-empty buckets from the old bucket array.
+ *
+ * Migrated entries are added to the new Bloom filter, the old array and
+ * its filter are released once the last bucket has been moved.
+ *
+ * @param table hash table
+ * @param n number of buckets to migrate
+ */
+static inline void htable_rehash_step(struct htable *table, size_t n) {
+  struct hlist_node *pos, *next;
+
+  if (!htable_rehashing(table)) {
+    return;
+  }
+
+  // Bound the number of empty buckets visited so a sparse table cannot stall
+  size_t empty = n * 10;
+  while (n > 0 && table->rehash_idx < table->old_size) {
+    struct hlist_head *old = &table->old_bucks[table->rehash_idx++];
+    if (hlist_empty(old)) {
+      if (--empty == 0) {
+        break;
+      }
+      continue;
+    }
+
+    hlist_for_each_safe(pos, next, old) {
+      struct htable_entry *e = hlist_entry(pos, struct htable_entry, node);
+      __hlist_del(pos);
+      hlist_add_head(pos, &table->bucks[htable_which_bucket(table, e->hash)]);
+      bloom_add(&table->bloom, e->hash);
+    }
+    n--;
+  }
+
+  if (table->rehash_idx >= table->old_size) {
+    __htable_free_bucks(table->flags, table->old_bucks, table->old_size);
+    table->old_bucks = NULL;
+    table->old_size = 0;
+    table->rehash_idx = 0;
+    bloom_destroy(&table->old_bloom);
+  }
+}
+
+/**
+ * Complete any resize in progress.
+ *
+ * @param table hash table
+ */
+static inline void htable_rehash_finish(struct htable *table) {
+  while (htable_rehashing(table)) {
+    htable_rehash_step(table, table->old_size);
+  }
+}
+
+/**
+ * Start migrating the table into a bucket array of the given size.
+ *
+ * Entries are moved lazily by subsequent add, find and delete operations,
+ * together with a Bloom filter sized for the new bucket array. Resizing to
+ * the current size thus rebuilds the filter, dropping bits left behind by
+ * deleted entries. The table is left untouched when a resize is already in
+ * progress or the new bucket array cannot be allocated.
+ *
+ * @param table hash table
+ * @param size new number of buckets, must be a power of two
+ * @return 0 on success, -1 otherwise
+ */
+static inline int htable_resize(struct htable *table, size_t size) {
+  struct bloom bloom;
+
+  if (htable_rehashing(table)) {
+    return -1;
+  }
+
+  struct hlist_head *bucks = __htable_alloc_bucks(table->flags, size);
+  if (!bucks) {
+    return -1;
+  }
+  if (bloom_init(&bloom, size * HTABLE_GROW_LOAD, HTABLE_BLOOM_FPR) < 0) {
+    __htable_free_bucks(table->flags, bucks, size);
+    return -1;
+  }
+
+  table->old_bucks = table->bucks;
+  table->old_size = table->size;
+  table->old_bloom = table->bloom;
+  table->rehash_idx = 0;
+  table->bucks = bucks;
+  table->size = size;
+  table->bloom = bloom;
+
+  return 0;
+}
+
+/**
+ * Rebuild the table Bloom filter without deleted entries.
+ *
+ * Like resizing, the rebuild is done incrementally.
+ *
+ * @param table hash table
+ */
+static inline int htable_rebuild(struct htable *table) {
+  return htable_resize(table, table->size);
+}
+
+/**
+ * Shrink the table if its load dropped below the shrink threshold.
+ *
+ * Shrinking is never done implicitly, call this after large deletions.
+ * It must not be called while iterating over the table.
+ *
+ * @param table hash table
+ */
+static inline void htable_shrink(struct htable *table) {
+  size_t size = table->size;
+
+  while (size > HASH_NUM_BUCKETS && table->count * HTABLE_SHRINK_LOAD < size) {
+    size >>= 1;
+  }
+  if (size != table->size) {
+    htable_resize(table, size);
   }
-  bloom_finit(table->bitvect);
 }
 
 /**
@@ -168,44 +496,168 @@ static inline void htable_destroy(struct htable *table) {
 static inline void htable_add(struct htable *table, struct htable_entry *entry, void *key, size_t len) {
   INIT_HTABLE_ENTRY(entry, key, len);
 
-  unsigned hash = jhash(key, len, 0);
+  htable_rehash_step(table, HTABLE_REHASH_STEP);
+
+  unsigned hash = htable_hash(table, key, len);
   unsigned buck = htable_which_bucket(table, hash);
+  entry->hash = hash;
   hlist_add_head(&entry->node, &table->bucks[buck]);
 
-  //  struct htable_bucket *bucket = &table->buckets[bucket];
-  //  if (bucket->count > (bucket->expand_mult + 1) * HASH_BUCKET_THRESH && !table->noexpand)
-  //      htable_expand_buckets(table);
-
-  bloom_set(table->bitvect, hash);
+  bloom_add(&table->bloom, hash);
 
   table->count++;
+
+  if (table->count > table->size * HTABLE_GROW_LOAD) {
+    htable_resize(table, table->size << 1);
+  }
 }
 
+/** Tests whether entry matches the key, comparing the cached hash first */
+#define htable_entry_match(e, hash, key, len) \
+  ((e)->hash == (hash) && (e)->len == (len) && memcmp((e)->key, (key), (len)) == 0)
+
 /**
- * Looks up the hash table for the presence of key.
+ * Looks for the key in a chain of entries.
+ *
+ * @param h the hash table the chain belongs to
+ * @param n first node of the chain
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key
+ */
+static inline struct htable_entry *__htable_find_chain(struct htable *h, struct hlist_node *n,
+    const void *key, size_t len, unsigned hash) {
+  struct htable_entry *e;
+
+  (void)h;
+  hlist_for_each_entry_from(e, n, node) {
+    htable_count_stat(h, probes, 1);
+    if (htable_entry_match(e, hash, key, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks for the key among the entries not yet migrated by a resize.
  *
  * @param h the hash table to look into
  * @param key the key to look for
  * @param len the length of the key
+ * @param hash the hash of the key
+ */
+static inline struct htable_entry *__htable_find_old(struct htable *h, const void *key, size_t len, unsigned hash) {
+  if (htable_rehashing(h) && bloom_test(&h->old_bloom, hash)) {
+    unsigned buck = htable_which_old_bucket(h, hash);
+    if (buck >= h->rehash_idx) {
+      return __htable_find_chain(h, h->old_bucks[buck].first, key, len, hash);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up the hash table for the presence of key with precomputed hash.
+ *
+ * @param h the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key, as returned by htable_hash()
  * @return a pointer to the entry that matches the key, NULL otherwise
  */
-static inline struct htable_entry *htable_find(const struct htable *h, const void *key, size_t len) {
+static inline struct htable_entry *htable_find_hash(struct htable *h, const void *key, size_t len, unsigned hash) {
   struct htable_entry *e;
-  struct hlist_node *n;
 
-  unsigned hash = jhash(key, len, 0);
+  htable_rehash_step(h, HTABLE_REHASH_STEP);
+
   unsigned buck = htable_which_bucket(h, hash);
 
-  if (bloom_test(h->bitvect, hash)) {
-    if (!hlist_empty(&h->bucks[buck])) {
-      hlist_for_each_entry(e, n, &h->bucks[buck], node) {
-        if (e->len == len && memcmp(e->key, key, len) == 0) {
-          return e;
-        }
+  if (!bloom_test(&h->bloom, hash) || !(e = __htable_find_chain(h, h->bucks[buck].first, key, len, hash))) {
+    e = __htable_find_old(h, key, len, hash);
+  }
+  if (e) {
+    htable_count_stat(h, hits, 1);
+  } else {
+    htable_count_stat(h, misses, 1);
+  }
+  return e;
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param h the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct htable_entry *htable_find(struct htable *h, const void *key, size_t len) {
+  return htable_find_hash(h, key, len, htable_hash(h, key, len));
+}
+
+/**
+ * Looks up the hash table for the presence of several keys.
+ *
+ * Keys are processed in groups of HTABLE_BATCH_SIZE as a pipeline: all
+ * keys of a group are hashed and their bucket heads prefetched, then the
+ * first entry of each chain is prefetched, and only then are the chains
+ * walked. The cache misses of the lookups within a group thus overlap
+ * instead of stalling one after the other. The Bloom filter is bypassed
+ * since the bucket head is already in cache by the time it is consulted.
+ * Groups of keys of equal length are hashed with jhash_bulk() when the
+ * table uses jhash.
+ *
+ * @param h the hash table to look into
+ * @param keys the keys to look for
+ * @param lens the lengths of the keys
+ * @param n the number of keys
+ * @param results set to the entry matching each key, NULL if not found
+ * @return the number of keys found
+ */
+static inline size_t htable_find_batch(struct htable *h, const void *const *keys, const size_t *lens,
+    size_t n, struct htable_entry **results) {
+  unsigned hashes[HTABLE_BATCH_SIZE];
+  struct hlist_node *firsts[HTABLE_BATCH_SIZE];
+  size_t found = 0;
+
+  htable_rehash_step(h, HTABLE_REHASH_STEP);
+
+  for (size_t base = 0; base < n; base += HTABLE_BATCH_SIZE) {
+    size_t count = min_t(size_t, n - base, HTABLE_BATCH_SIZE);
+
+    size_t same = 1;
+    while (same < count && lens[base + same] == lens[base]) {
+      same++;
+    }
+    if (!h->hash && same == count) {
+      jhash_bulk(keys + base, lens[base], h->seed, hashes, count);
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        hashes[i] = htable_hash(h, keys[base + i], lens[base + i]);
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      prefetch(&h->bucks[htable_which_bucket(h, hashes[i])]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      firsts[i] = h->bucks[htable_which_bucket(h, hashes[i])].first;
+      if (firsts[i]) {
+        prefetch(firsts[i]);
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      struct htable_entry *e = __htable_find_chain(h, firsts[i], keys[base + i], lens[base + i], hashes[i]);
+      if (!e) {
+        e = __htable_find_old(h, keys[base + i], lens[base + i], hashes[i]);
       }
+      results[base + i] = e;
+      found += e != NULL;
     }
   }
-  return NULL;
+  htable_count_stat(h, hits, found);
+  htable_count_stat(h, misses, n - found);
+  return found;
 }
 
 static inline struct htable_entry *htable_del_key(struct htable *table, const void *key, size_t len) {
@@ -220,8 +672,84 @@ static inline struct htable_entry *htable_del_key(struct htable *table, const vo
   return NULL;
 }
 
+/**
+ * Remove entry previously added to the hash table.
+ *
+ * The entry is unlinked directly, its key is neither hashed nor compared.
+ *
+ * @param table the hash table to remove entry from
+ * @param entry the hash entry
+ * @return the removed entry, NULL if it was not in the table
+ */
 static inline struct htable_entry *htable_del_entry(struct htable *table, struct htable_entry *entry) {
-  return htable_del_key(table, entry->key, entry->len);
+  if (hlist_unhashed(&entry->node)) {
+    return NULL;
+  }
+
+  htable_rehash_step(table, HTABLE_REHASH_STEP);
+
+  hlist_del_init(&entry->node);
+  table->count--;
+
+  return entry;
+}
+
+static inline void __htable_chain_stats(struct hlist_head *bucks, size_t size, size_t from,
+    struct htable_stats *stats) {
+  for (size_t i = from; i < size; ++i) {
+    struct hlist_node *n;
+    size_t len = 0;
+
+    hlist_for_each(n, &bucks[i]) {
+      len++;
+    }
+    stats->chains[min_t(size_t, len, HTABLE_STATS_HIST - 1)]++;
+    stats->max_chain = max(stats->max_chain, len);
+  }
+}
+
+/**
+ * Take a snapshot of the table occupancy and lookup counters.
+ *
+ * Walks all buckets, which takes time linear in the table size. While the
+ * table is resized, chains of the old bucket array not migrated yet are
+ * included in the histogram.
+ *
+ * @param table hash table
+ * @param stats filled with the table statistics
+ */
+static inline void htable_get_stats(struct htable *table, struct htable_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  stats->size = table->size;
+  stats->count = table->count;
+  stats->load = (double)table->count / table->size;
+  stats->bloom_fill = bloom_fill_ratio(&table->bloom);
+
+  __htable_chain_stats(table->bucks, table->size, 0, stats);
+  if (htable_rehashing(table)) {
+    __htable_chain_stats(table->old_bucks, table->old_size, table->rehash_idx, stats);
+  }
+
+#ifdef HTABLE_STATS
+  stats->counters = table->counters;
+  if (table->counters.hits + table->counters.misses) {
+    stats->avg_probes = (double)table->counters.probes / (table->counters.hits + table->counters.misses);
+  }
+#endif
+}
+
+/**
+ * Reset the lookup counters.
+ *
+ * @param table hash table
+ */
+static inline void htable_reset_stats(struct htable *table) {
+#ifdef HTABLE_STATS
+  memset(&table->counters, 0, sizeof(table->counters));
+#else
+  (void)table;
+#endif
 }
 
 /**
@@ -246,11 +774,13 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
 /**
  * Iterate over hash table elements.
  *
+ * Any resize in progress is completed before the iteration starts.
+ *
  * @param pos struct htable entry to use as a loop counter
  * @param table your table
  */
 #define htable_for_each(pos, table) \
-  for (int i = 0; i < (table)->size; ++i) \
+  for (int i = (htable_rehash_finish(table), 0); i < (table)->size; ++i) \
     for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
          pos; pos = hlist_entry(pos->node.next, typeof(*pos), node))
 
@@ -262,7 +792,7 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param table your table
  */
 #define htable_for_each_safe(pos, n, table) \
-  for (int i = 0; i < (table)->size; ++i) \
+  for (int i = (htable_rehash_finish(table), 0); i < (table)->size; ++i) \
     for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
          pos && ({ n = hlist_entry(pos->node.next, typeof(*pos), node); 1; }); \
          pos = n)
@@ -276,7 +806,7 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param member the name of the enry within the struct
  */
 #define htable_for_each_entry(tpos, pos, table, member) \
-  for (int i = 0; i < (table)->size; ++i) \
+  for (int i = (htable_rehash_finish(table), 0); i < (table)->size; ++i) \
     for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
          pos && ({ tpos = hash_entry(pos, typeof(*tpos), member); 1;}); \
          pos = hlist_entry(pos->node.next, typeof(*pos), node))
@@ -290,7 +820,7 @@ static inline struct htable_entry *htable_del_entry(struct htable *table, struct
  * @param member the name of the enry within the struct
  */
 #define htable_for_each_entry_safe(tpos, pos, n, table, member) \
-  for (int i = 0; i < (table)->size; ++i) \
+  for (int i = (htable_rehash_finish(table), 0); i < (table)->size; ++i) \
     for (pos = hlist_entry((table)->bucks[i].first, typeof(*pos), node); \
          pos && ({ n = hlist_entry(pos->node.next, typeof(*pos), node); 1; }) && ({ tpos = hash_entry(pos, typeof(*tpos), member); 1;}); \
          pos = n)
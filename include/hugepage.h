@@ -0,0 +1,43 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HUGEPAGE_H_
+#define HUGEPAGE_H_
+
+#include <stddef.h>
+
+/*
+ * Allocation of large arrays backed by huge pages.
+ *
+ * Arrays of at least HUGE_PAGE_SIZE bytes are mapped from the reserved
+ * huge page pool when there is one. Otherwise they are mapped at a huge page
+ * aligned address and marked with MADV_HUGEPAGE, so transparent huge pages
+ * back them when the kernel allows it, and fall back to normal pages if not.
+ * Smaller arrays are mapped with normal pages.
+ *
+ * The memory is zeroed, and must be released with hugepage_free() given the
+ * size it was allocated with.
+ */
+
+/** Size of a huge page */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/* Externals are commented with implementation */
+extern void *hugepage_alloc(size_t size);
+extern void hugepage_free(void *ptr, size_t size);
+
+#endif // HUGEPAGE_H_
@@ -0,0 +1,63 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAP_H_
+#define IMAP_H_
+
+#include "ohtable.h"
+
+#include <stdint.h>
+
+/*
+ * Hash maps specialized for integer keys.
+ *
+ * DEFINE_IMAP() instantiates DEFINE_HTABLE() for an integer key type.
+ * Keys are hashed with hash_mix64() alone and compared with a single integer
+ * comparison, a lookup never follows a pointer to the key.
+ *
+ * Example:
+ *
+ *   DEFINE_IMAP(idmap, uint64_t, struct obj *)
+ *
+ *   struct idmap map;
+ *   idmap_init(&map);
+ *   idmap_put(&map, obj->id, obj);
+ *   struct obj **o = idmap_find(&map, id);
+ */
+
+/** Integer keys are hashed as they are by ohtable_map_hash() */
+#define imap_key_hash(key) ((uint64_t)(key))
+#define imap_key_eq(a, b) ((a) == (b))
+
+/**
+ * Iterate over the entries of an integer keyed map.
+ */
+#define imap_for_each(pos, map) ohtable_map_for_each(pos, map)
+
+/**
+ * Define an integer keyed hash map type and its functions.
+ *
+ * See DEFINE_HTABLE() for the generated functions.
+ *
+ * @param name name of the map type
+ * @param key_t integer key type, at most 64 bits wide
+ * @param val_t value type
+ */
+#define DEFINE_IMAP(name, key_t, val_t) \
+  DEFINE_HTABLE(name, key_t, val_t, imap_key_hash, imap_key_eq)
+
+#endif // IMAP_H_
@@ -0,0 +1,81 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ITREE_H_
+#define ITREE_H_
+
+#include "rbtree.h"
+
+#include <stdint.h>
+
+/*
+ * Interval tree.
+ *
+ * Closed intervals [start, last] are kept in a red black tree ordered by
+ * start, every node also holding the largest last of its subtree. Queries
+ * skip the subtrees which end before the queried range, so finding all k
+ * intervals overlapping a range takes O(k log n) rather than a walk over
+ * the whole tree. Several intervals may have the same bounds.
+ *
+ * Example, all timers whose window contains now:
+ *
+ *   struct itree_node *it;
+ *   itree_for_each_overlap(it, &timers, now, now)
+ *     fire(container_of(it, struct timer, window));
+ */
+
+/** Interval tree node */
+struct itree_node {
+    struct rb_node rb;
+    /** First point of the interval */
+    uint64_t start;
+    /** Last point of the interval */
+    uint64_t last;
+    /** Largest last within the subtree rooted at this node */
+    uint64_t __subtree_last;
+};
+
+/* Externals are commented with implementation */
+extern void itree_insert(struct itree_node *node, struct rb_root *root);
+extern void itree_remove(struct itree_node *node, struct rb_root *root);
+extern struct itree_node *itree_iter_first(const struct rb_root *root, uint64_t start, uint64_t last);
+extern struct itree_node *itree_iter_next(struct itree_node *node, uint64_t start, uint64_t last);
+
+/**
+ * Find an interval containing a point.
+ *
+ * @param root tree root
+ * @param point the point
+ * @return the interval with the lowest start containing point, or NULL
+ */
+static inline struct itree_node *itree_stab(const struct rb_root *root, uint64_t point) {
+    return itree_iter_first(root, point, point);
+}
+
+/**
+ * Iterate over the intervals overlapping [start, last] by increasing start.
+ *
+ * @param pos struct itree_node to use as a loop cursor
+ * @param root tree root
+ * @param start first point of the range
+ * @param last last point of the range
+ */
+#define itree_for_each_overlap(pos, root, start, last) \
+    for (pos = itree_iter_first(root, start, last); pos; \
+         pos = itree_iter_next(pos, start, last))
+
+#endif // ITREE_H_
@@ -18,9 +18,13 @@
 #ifndef JHASH_H_
 #define JHASH_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <sys/uio.h>
+
 #include "bitops.h"
 
 /* Best hash sizes are of power of two */
@@ -50,18 +54,104 @@
 /* An arbitrary initial parameter */
 #define JHASH_INITVAL 0xdeadbeef
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define JHASH_LITTLE_ENDIAN 1
+#endif
+
 /**
- * Hash an arbitrary key
+ * Load 32 bits in little-endian order from a possibly unaligned address.
  *
- * The generic version, hashes an arbitrary sequence of bytes.
- * No alignment or length assumptions are made about the input key.
+ * Little-endian targets do a single word load, others assemble the bytes.
+ *
+ * @param k pointer to the bytes
+ */
+static inline uint32_t __jhash_get_le32(const uint8_t *k) {
+#ifdef JHASH_LITTLE_ENDIAN
+  uint32_t w;
+  memcpy(&w, k, sizeof(w));
+  return w;
+#else
+  return k[0] + ((uint32_t)k[1] << 8) + ((uint32_t)k[2] << 16) + ((uint32_t)k[3] << 24);
+#endif
+}
+
+/* Externals are commented with implementation */
+extern void jhash_bulk(const void *const *keys, uint32_t length, uint32_t initval, uint32_t *hashes, size_t n);
+
+/**
+ * Add the last block of a key and do the final mixing.
+ *
+ * @param a, b, c internal state
+ * @param k last block of the key
+ * @param length the length of the last block, 0 to 12
+ * @return the hash value of the key in the low 32 bits, the second hash
+ *         value (b) in the high 32 bits
+ */
+static inline uint64_t __jhash_last(uint32_t a, uint32_t b, uint32_t c, const uint8_t *k, uint32_t length) {
+  // Last block: affect all 32 bits of (c)
+#ifdef JHASH_LITTLE_ENDIAN
+  // Whole words are loaded at once, the remaining bytes fall through
+  switch (length) {
+  case 12: c += __jhash_get_le32(k + 8);
+           b += __jhash_get_le32(k + 4);
+           a += __jhash_get_le32(k);
+           break;
+  case 11: c += (uint32_t)k[10] << 16; // fallthrough
+  case 10: c += (uint32_t)k[9] << 8; // fallthrough
+  case 9:  c += k[8]; // fallthrough
+  case 8:  b += __jhash_get_le32(k + 4);
+           a += __jhash_get_le32(k);
+           break;
+  case 7:  b += (uint32_t)k[6] << 16; // fallthrough
+  case 6:  b += (uint32_t)k[5] << 8; // fallthrough
+  case 5:  b += k[4]; // fallthrough
+  case 4:  a += __jhash_get_le32(k);
+           break;
+  case 3:  a += (uint32_t)k[2] << 16; // fallthrough
+  case 2:  a += (uint32_t)k[1] << 8; // fallthrough
+  case 1:  a += k[0];
+           break;
+  case 0: // Nothing left to add
+    return (uint64_t)b << 32 | c;
+  }
+  __jhash_final(a, b, c);
+#else
+  // All the case statements fall through
+  switch (length) {
+  case 12: c += (uint32_t)k[11] << 24; // fallthrough
+  case 11: c += (uint32_t)k[10] << 16; // fallthrough
+  case 10: c += (uint32_t)k[9] << 8; // fallthrough
+  case 9:  c += k[8]; // fallthrough
+  case 8:  b += (uint32_t)k[7] << 24; // fallthrough
+  case 7:  b += (uint32_t)k[6] << 16; // fallthrough
+  case 6:  b += (uint32_t)k[5] << 8; // fallthrough
+  case 5:  b += k[4]; // fallthrough
+  case 4:  a += (uint32_t)k[3] << 24; // fallthrough
+  case 3:  a += (uint32_t)k[2] << 16; // fallthrough
+  case 2:  a += (uint32_t)k[1] << 8; // fallthrough
+  case 1:  a += k[0];
+     __jhash_final(a, b, c); // fallthrough
+  case 0: // Nothing left to add
+    break;
+  }
+#endif
+
+  return (uint64_t)b << 32 | c;
+}
+
+/**
+ * Hash an arbitrary key into two 32-bit values.
+ *
+ * The low 32 bits are the jhash() value of the key, the high 32 bits a
+ * second hash value which comes at no extra cost, like the two values of
+ * hashlittle2(). Use this when 32 bits are not enough to tell keys apart.
  *
  * @param k sequence of bytes as key
  * @param length the length of the key
  * @param initval the previous hash, or an arbitray value
- * @return the hash value of the key
+ * @return the two hash values of the key
  */
-static inline uint32_t jhash(const void *key, uint32_t length, uint32_t initval) {
+static inline uint64_t jhash64(const void *key, uint32_t length, uint32_t initval) {
   uint32_t a, b, c;
   const uint8_t *k = key;
 
@@ -70,37 +160,131 @@ static inline uint32_t jhash(const void *key, uint32_t length, uint32_t initval)
 
   // All but the last block: affect some 32 bits of (a,b,c)
   while (length > 12) {
-    a += (k[0] + ((uint32_t)k[1] << 8) + ((uint32_t)k[2] << 16) + ((uint32_t)k[3] << 24));
-    b += (k[4] + ((uint32_t)k[5] << 8) + ((uint32_t)k[6] << 16) + ((uint32_t)k[7] << 24));
-    c += (k[8] + ((uint32_t)k[9] << 8) + ((uint32_t)k[10] << 16) + ((uint32_t)k[11] << 24));
-    //a += __get_unaligned_cpuint32_t(k);
-    //b += __get_unaligned_cpuint32_t(k + 4);
-    //c += __get_unaligned_cpuint32_t(k + 8);
+    a += __jhash_get_le32(k);
+    b += __jhash_get_le32(k + 4);
+    c += __jhash_get_le32(k + 8);
     __jhash_mix(a, b, c);
     length -= 12;
     k += 12;
   }
-  // Last block: affect all 32 bits of (c)
-  // All the case statements fall through
-  switch (length) {
-  case 12: c += (uint32_t)k[11] << 24;
-  case 11: c += (uint32_t)k[10] << 16;
-  case 10: c += (uint32_t)k[9] << 8;
-  case 9:  c += k[8];
-  case 8:  b += (uint32_t)k[7] << 24;
-  case 7:  b += (uint32_t)k[6] << 16;
-  case 6:  b += (uint32_t)k[5] << 8;
-  case 5:  b += k[4];
-  case 4:  a += (uint32_t)k[3] << 24;
-  case 3:  a += (uint32_t)k[2] << 16;
-  case 2:  a += (uint32_t)k[1] << 8;
-  case 1:  a += k[0];
-     __jhash_final(a, b, c);
-  case 0: // Nothing left to add
-    break;
+  return __jhash_last(a, b, c, k, length);
+}
+
+/**
+ * Hash an arbitrary key
+ *
+ * The generic version, hashes an arbitrary sequence of bytes.
+ * No alignment or length assumptions are made about the input key.
+ *
+ * @param k sequence of bytes as key
+ * @param length the length of the key
+ * @param initval the previous hash, or an arbitray value
+ * @return the hash value of the key
+ */
+static inline uint32_t jhash(const void *key, uint32_t length, uint32_t initval) {
+  return (uint32_t)jhash64(key, length, initval);
+}
+
+/** State of a jhash computed over several fragments */
+struct jhash_state {
+  /** Internal state */
+  uint32_t a, b, c;
+  /** Number of buffered bytes */
+  uint32_t buflen;
+  /** Bytes of the current block, which is mixed once more bytes follow */
+  uint8_t buf[12];
+};
+
+/**
+ * Start hashing a key made of several fragments.
+ *
+ * The total length is part of the initial state, it must thus be known
+ * upfront.
+ *
+ * @param state hash state
+ * @param length the total length of the key
+ * @param initval the previous hash, or an arbitray value
+ */
+static inline void jhash_init(struct jhash_state *state, uint32_t length, uint32_t initval) {
+  state->a = state->b = state->c = JHASH_INITVAL + length + initval;
+  state->buflen = 0;
+}
+
+/**
+ * Hash the next fragment of a key.
+ *
+ * Whole blocks are mixed straight from the fragment, only blocks split
+ * across fragments and the last block are buffered.
+ *
+ * @param state hash state
+ * @param data the fragment
+ * @param len the length of the fragment
+ */
+static inline void jhash_update(struct jhash_state *state, const void *data, uint32_t len) {
+  const uint8_t *k = data;
+
+  while (len > 0) {
+    // A full block is mixed only once more bytes are known to follow
+    if (state->buflen == 12) {
+      state->a += __jhash_get_le32(state->buf);
+      state->b += __jhash_get_le32(state->buf + 4);
+      state->c += __jhash_get_le32(state->buf + 8);
+      __jhash_mix(state->a, state->b, state->c);
+      state->buflen = 0;
+    }
+    if (state->buflen == 0) {
+      while (len > 12) {
+        state->a += __jhash_get_le32(k);
+        state->b += __jhash_get_le32(k + 4);
+        state->c += __jhash_get_le32(k + 8);
+        __jhash_mix(state->a, state->b, state->c);
+        len -= 12;
+        k += 12;
+      }
+    }
+
+    uint32_t n = 12 - state->buflen < len ? 12 - state->buflen : len;
+    memcpy(state->buf + state->buflen, k, n);
+    state->buflen += n;
+    len -= n;
+    k += n;
   }
+}
 
-  return c;
+/**
+ * Finish hashing a key made of several fragments.
+ *
+ * All the bytes announced to jhash_init() must have been passed to
+ * jhash_update(), the result is then the same as jhash() on the
+ * concatenated fragments.
+ *
+ * @param state hash state
+ * @return the hash value of the key
+ */
+static inline uint32_t jhash_final(struct jhash_state *state) {
+  return (uint32_t)__jhash_last(state->a, state->b, state->c, state->buf, state->buflen);
+}
+
+/**
+ * Hash a key scattered across several buffers.
+ *
+ * @param iov the buffers
+ * @param iovcnt the number of buffers
+ * @param initval the previous hash, or an arbitray value
+ * @return the same value as jhash() on the concatenated buffers
+ */
+static inline uint32_t jhash_iov(const struct iovec *iov, int iovcnt, uint32_t initval) {
+  struct jhash_state state;
+  uint32_t length = 0;
+
+  for (int i = 0; i < iovcnt; ++i) {
+    length += iov[i].iov_len;
+  }
+  jhash_init(&state, length, initval);
+  for (int i = 0; i < iovcnt; ++i) {
+    jhash_update(&state, iov[i].iov_base, iov[i].iov_len);
+  }
+  return jhash_final(&state);
 }
 
 /**
@@ -129,10 +313,10 @@ static inline uint32_t jhash2(const uint32_t *k, uint32_t length, uint32_t initv
 
   // Handle the last 3 uint32_t's: all the case statements fall through
   switch (length) {
-  case 3: c += k[2];
-  case 2: b += k[1];
+  case 3: c += k[2]; // fallthrough
+  case 2: b += k[1]; // fallthrough
   case 1: a += k[0];
-    __jhash_final(a, b, c);
+    __jhash_final(a, b, c); // fallthrough
   case 0: // Nothing left to add
     break;
   }
@@ -84,6 +84,14 @@
 #define offsetof(TYPE, MEMBER) ((size_t)&((TYPE *)0)->MEMBER)
 #endif
 
+/**
+ * Hint the processor to fetch a cache line ahead of its use.
+ * @param x address within the cache line
+ */
+#ifndef prefetch
+#define prefetch(x) __builtin_prefetch(x)
+#endif
+
 #ifndef max
 #define max(x, y) ({ \
     typeof(x) _max1 = (x); \
@@ -0,0 +1,203 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFHTABLE_H_
+#define LFHTABLE_H_
+
+#include "atomic.h"
+#include "bitops.h"
+#include "htable.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Lock-free hash set based on split-ordered lists.
+ *
+ * All entries live in a single singly linked list sorted by the bit
+ * reversed key hash. Buckets are pointers to dummy nodes within the list,
+ * so doubling the number of buckets only splits each bucket in two by
+ * inserting a new dummy node lazily on first access, entries never move.
+ * Bucket pointers are kept in segments of growing size which are
+ * allocated on demand and never reallocated.
+ *
+ * Insertion, lookup and removal only use compare and swap operations and
+ * never block. Removal marks the link of the entry before unlinking it,
+ * traversals unlink marked entries they come across.
+ *
+ * Lookups and iterations must run within a read-side critical section
+ * delimited by lfhtable_read_lock() and lfhtable_read_unlock(), insertions
+ * and removals enter one of their own. A removed entry may still be
+ * referenced by concurrent operations, it must not be freed nor reused
+ * before lfhtable_synchronize() returns, which waits for all read-side
+ * critical sections in progress.
+ */
+
+/** Grow the table once the average chain length exceeds this value */
+#define LFHTABLE_GROW_LOAD 2
+/** Buckets in the first segment are 1 << LFHTABLE_SEGMENT_SHIFT */
+#define LFHTABLE_SEGMENT_SHIFT 6
+/** Upper bound on the number of buckets, bucket indexes fit in 31 bits */
+#define LFHTABLE_MAX_BUCKETS (1UL << 31)
+/** Number of segments needed to address LFHTABLE_MAX_BUCKETS */
+#define LFHTABLE_SEGMENTS (32 - LFHTABLE_SEGMENT_SHIFT)
+/** Low bit of a link marking its node as removed */
+#define LFHTABLE_MARK ((uintptr_t)1)
+/** Number of reader counter slots */
+#define LFHTABLE_READER_SLOTS 64
+
+#define LFHTABLE_CACHELINE_SIZE 64
+
+/** List node, either an entry or the dummy node of a bucket */
+struct lfhtable_node {
+  /** Next node in split order, tagged with LFHTABLE_MARK once removed */
+  atomic_uintptr_t next;
+  /** Bit reversed hash, odd for entries and even for dummy nodes */
+  uint32_t so_key;
+};
+
+/** Hash set entry identified by key */
+struct lfhtable_entry {
+  /** Linked list node */
+  struct lfhtable_node node;
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Result of hash function applied to key */
+  unsigned hash;
+};
+
+/** Readers in each of the two grace period phases */
+struct lfhtable_readers {
+  atomic_ulong count[2];
+} __attribute__((aligned(LFHTABLE_CACHELINE_SIZE)));
+
+/** Lock-free hash set */
+struct lfhtable {
+  /** Dummy node of bucket 0, head of the list */
+  struct lfhtable_node head;
+  /** Number of buckets, a power of two */
+  atomic_size_t size;
+  /** Number of entries in the table */
+  atomic_size_t count;
+  /** Segments of bucket pointers, the first one holds buckets 0 to 63 */
+  atomic_uintptr_t segments[LFHTABLE_SEGMENTS];
+  /** Grace period counter, its low bit selects the reader phase */
+  atomic_uint epoch;
+  /** Serializes grace periods */
+  pthread_mutex_t sync_lock;
+  /** Reader counters */
+  struct lfhtable_readers readers[LFHTABLE_READER_SLOTS];
+};
+
+#define lfhtable_node_ptr(link) ((struct lfhtable_node *)((link) & ~LFHTABLE_MARK))
+#define lfhtable_is_dummy(node) (!((node)->so_key & 1))
+
+/* Externals are commented with implementation */
+extern int lfhtable_init(struct lfhtable *table);
+extern int lfhtable_init_n(struct lfhtable *table, size_t n);
+extern void lfhtable_destroy(struct lfhtable *table);
+
+extern unsigned lfhtable_read_lock(struct lfhtable *table);
+extern void lfhtable_read_unlock(struct lfhtable *table, unsigned token);
+extern void lfhtable_synchronize(struct lfhtable *table);
+
+extern struct lfhtable_entry *lfhtable_add(struct lfhtable *table, struct lfhtable_entry *entry,
+    void *key, size_t len);
+extern struct lfhtable_entry *lfhtable_find(struct lfhtable *table, const void *key, size_t len);
+extern struct lfhtable_entry *lfhtable_del_key(struct lfhtable *table, const void *key, size_t len);
+extern struct lfhtable_entry *lfhtable_del_entry(struct lfhtable *table, struct lfhtable_entry *entry);
+
+/**
+ * Returns the number of entries in the table.
+ *
+ * The result is only a snapshot when there are concurrent writers.
+ *
+ * @param table hash table
+ */
+static inline size_t lfhtable_count(struct lfhtable *table) {
+  return atomic_load_explicit(&table->count, memory_order_relaxed);
+}
+
+/**
+ * Get the entry following a node in split order.
+ *
+ * Dummy nodes and removed entries are skipped. Must be called from within
+ * a read-side critical section.
+ *
+ * @param node node to start from
+ * @return next entry, NULL at the end of the list
+ */
+static inline struct lfhtable_entry *lfhtable_next(struct lfhtable_node *node) {
+  uintptr_t next;
+
+  while ((node = lfhtable_node_ptr(atomic_load_explicit(&node->next, memory_order_acquire)))) {
+    next = atomic_load_explicit(&node->next, memory_order_acquire);
+    if (!lfhtable_is_dummy(node) && !(next & LFHTABLE_MARK)) {
+      return container_of(node, struct lfhtable_entry, node);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the hash table pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define lfhash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define lfhash_find_entry(table, key, len, type, member) ({ \
+    struct lfhtable_entry *e = lfhtable_find((table), (key), (len)); \
+    (type *)(e ? lfhash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over entries in table.
+ *
+ * Entries added or removed concurrently may or may not be visited. Must be
+ * used from within a read-side critical section.
+ *
+ * @param table the hash table
+ * @param pos the struct lfhtable_entry * to use as a loop cursor
+ */
+#define lfhtable_for_each(table, pos) \
+  for (pos = lfhtable_next(&(table)->head); pos; pos = lfhtable_next(&pos->node))
+
+/**
+ * Iterate over entries in table of given type.
+ *
+ * @param table the hash table
+ * @param tpos the type * to use as a loop cursor
+ * @param pos the struct lfhtable_entry * to use as a loop cursor
+ * @param member the name of the entry within the struct
+ */
+#define lfhtable_for_each_entry(table, tpos, pos, member) \
+  for (pos = lfhtable_next(&(table)->head); \
+       pos && ({ tpos = lfhash_entry(pos, typeof(*tpos), member); 1; }); \
+       pos = lfhtable_next(&pos->node))
+
+#endif // LFHTABLE_H_
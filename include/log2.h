@@ -24,7 +24,7 @@
 #include <stdbool.h>
 
 /** Deal with unrepresentable constant logarithms */
-extern __attribute__((const, noreturn)) int ____ilog2_NaN(void);
+extern __attribute__((noreturn)) int ____ilog2_NaN(void);
 
 /*
  * Non-constant log of base 2 calculators.
@@ -0,0 +1,143 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MHTABLE_H_
+#define MHTABLE_H_
+
+#include "jhash.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Read-only hash table which is used directly from a file mapping.
+ *
+ * The table is built offline with a struct mhtable_builder and written to
+ * a file, which is later mapped with mhtable_open() and looked up in place
+ * without any deserialization. All references within the file are offsets
+ * from its start, so the mapping can live at any address.
+ *
+ * The file consists of a header, an array of nbuckets + 1 indexes into the
+ * slot array, the slot array sorted by bucket and finally the keys and
+ * values. Bucket b holds the slots from buckets[b] up to buckets[b + 1],
+ * a lookup scans the hashes of these slots and only touches the key data
+ * of a matching slot. Integers are stored in the byte order of the machine
+ * which built the table, files are rejected on a machine of the other
+ * byte order.
+ *
+ * Files are trusted, only the header is validated when a table is opened.
+ */
+
+/** File magic, "LKMHTBL" on little-endian machines */
+#define MHTABLE_MAGIC 0x004c4254484d4b4cULL
+/** File format version */
+#define MHTABLE_VERSION 1
+/** Alignment of keys and values within the file */
+#define MHTABLE_ALIGN 8
+
+/** File header */
+struct mhtable_header {
+  /** MHTABLE_MAGIC */
+  uint64_t magic;
+  /** MHTABLE_VERSION */
+  uint32_t version;
+  /** Seed of the key hash */
+  uint32_t seed;
+  /** Number of buckets, a power of two */
+  uint64_t nbuckets;
+  /** Number of entries */
+  uint64_t count;
+  /** Offset of the bucket index array */
+  uint64_t buckets;
+  /** Offset of the slot array */
+  uint64_t slots;
+  /** Total file size */
+  uint64_t size;
+};
+
+/** Entry descriptor */
+struct mhtable_slot {
+  /** Offset of the key, the value follows at the next aligned offset */
+  uint64_t off;
+  /** Hash of the key */
+  uint32_t hash;
+  /** Key length */
+  uint32_t klen;
+  /** Value length */
+  uint32_t vlen;
+  uint32_t __pad;
+};
+
+/** Mapped hash table */
+struct mhtable {
+  /** Start of the table */
+  const uint8_t *base;
+  /** Size of the table */
+  size_t size;
+  /** Whether the table was mapped by mhtable_open() */
+  int mapped;
+};
+
+/** Hash table builder */
+struct mhtable_builder {
+  /** Entry descriptors, offsets are relative to the data */
+  struct mhtable_slot *slots;
+  /** Number of entries */
+  size_t count;
+  /** Number of allocated descriptors */
+  size_t slots_size;
+  /** Keys and values */
+  uint8_t *data;
+  /** Length of data */
+  size_t len;
+  /** Allocated size of data */
+  size_t data_size;
+  /** Seed of the key hash */
+  uint32_t seed;
+};
+
+/* Externals are commented with implementation */
+extern int mhtable_open(struct mhtable *table, const char *path);
+extern int mhtable_init_mem(struct mhtable *table, const void *mem, size_t size);
+extern void mhtable_close(struct mhtable *table);
+extern const void *mhtable_find(const struct mhtable *table, const void *key, size_t len, size_t *vlen);
+
+extern int mhtable_builder_init(struct mhtable_builder *builder, uint32_t seed);
+extern void mhtable_builder_destroy(struct mhtable_builder *builder);
+extern int mhtable_builder_add(struct mhtable_builder *builder, const void *key, size_t len,
+    const void *val, size_t vlen);
+extern int mhtable_builder_write(const struct mhtable_builder *builder, const char *path);
+
+/**
+ * Returns the table header.
+ *
+ * @param table hash table
+ */
+static inline const struct mhtable_header *mhtable_header(const struct mhtable *table) {
+  return (const struct mhtable_header *)table->base;
+}
+
+/**
+ * Returns the number of entries in the table.
+ *
+ * @param table hash table
+ */
+static inline size_t mhtable_count(const struct mhtable *table) {
+  return mhtable_header(table)->count;
+}
+
+#endif // MHTABLE_H_
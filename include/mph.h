@@ -0,0 +1,168 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPH_H_
+#define MPH_H_
+
+#include "hash.h"
+#include "jhash.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Minimal perfect hash function for a static set of keys.
+ *
+ * mph_build() computes a function mapping each of the n keys of a set to
+ * a distinct index in [0, n). Keys are stored by the caller, typically in
+ * an array ordered by index, so a lookup is one hash computation followed
+ * by a single key comparison:
+ *
+ *   size_t i = mph_index(&mph, key, len);
+ *   if (i < n && strcmp(table[i].name, key) == 0) ...
+ *
+ * Keys not in the set map to an arbitrary index in [0, n).
+ *
+ * The construction is hash and displace (CHD, PTHash). Keys are hashed
+ * once with jhash64(), the high half selects one of about n / MPH_LAMBDA
+ * buckets. Each bucket has a pilot value, chosen at build time so that
+ * the keys of the bucket land in free positions of a table slightly larger
+ * than n, largest buckets first. The few keys landing past n are remapped
+ * to the free positions below n.
+ *
+ * The serialized form holds a header, the remapping array and the bucket
+ * pilots, one to four bytes each depending on the largest one. It is used in
+ * place by mph_load(), for instance from a file mapping.
+ */
+
+/** Average number of keys per bucket */
+#define MPH_LAMBDA 5
+/** Ratio of keys to positions, in percent */
+#define MPH_LOAD 99
+/** Largest pilot tried for a bucket before starting over with a new seed */
+#define MPH_MAX_PILOT (1 << 20)
+/** Number of seeds tried before giving up */
+#define MPH_MAX_SEEDS 16
+/** Serialized form magic, "MPH1" on little-endian machines */
+#define MPH_MAGIC 0x3148504d
+
+/** Serialized form header */
+struct mph_header {
+  /** MPH_MAGIC */
+  uint32_t magic;
+  /** Seed of the key hash */
+  uint32_t seed;
+  /** Number of keys */
+  uint32_t n;
+  /** Number of positions, at least n */
+  uint32_t size;
+  /** Number of buckets */
+  uint32_t nbuckets;
+  /** Size of a pilot in bytes, 1, 2 or 4 */
+  uint32_t pilot_size;
+};
+
+/** Minimal perfect hash function */
+struct mph {
+  /** Serialized form, the header followed by remapping array and pilots */
+  const struct mph_header *hdr;
+  /** Bucket pilots */
+  const uint8_t *pilots;
+  /** Index of positions from n up */
+  const uint32_t *remap;
+  /** Memory owned by the function, NULL if loaded from outside memory */
+  void *mem;
+};
+
+/* Externals are commented with implementation */
+extern int mph_build(struct mph *mph, const void *const *keys, const size_t *lens, size_t n, uint32_t seed);
+extern int mph_load(struct mph *mph, const void *mem, size_t size);
+extern void mph_destroy(struct mph *mph);
+extern size_t mph_serialized_size(const struct mph *mph);
+
+/** Odd constant with well spread bits, 2^64 divided by the golden ratio */
+#define MPH_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+/** Map a 32-bit value onto [0, n) */
+#define mph_reduce(x, n) ((uint32_t)(((uint64_t)(uint32_t)(x) * (n)) >> 32))
+
+/**
+ * Position of a key hash for a pilot.
+ *
+ * @param h key hash
+ * @param pilot bucket pilot
+ * @param size number of positions
+ */
+static inline uint32_t __mph_position(uint64_t h, uint32_t pilot, uint32_t size) {
+  uint64_t x = h ^ ((uint64_t)pilot * MPH_MULTIPLIER);
+
+  x = (x ^ (x >> 32)) * MPH_MULTIPLIER;
+  return mph_reduce(x >> 32, size);
+}
+
+/**
+ * Get the pilot of a bucket.
+ *
+ * @param mph perfect hash function
+ * @param bucket bucket index
+ */
+static inline uint32_t __mph_pilot(const struct mph *mph, uint32_t bucket) {
+  const uint8_t *p = mph->pilots + (size_t)bucket * mph->hdr->pilot_size;
+  uint16_t p16;
+  uint32_t p32;
+
+  switch (mph->hdr->pilot_size) {
+  case 1:
+    return *p;
+  case 2:
+    memcpy(&p16, p, sizeof(p16));
+    return p16;
+  default:
+    memcpy(&p32, p, sizeof(p32));
+    return p32;
+  }
+}
+
+/**
+ * Get the index of a key.
+ *
+ * @param mph perfect hash function
+ * @param key the key
+ * @param len the key length
+ * @return index in [0, n) if n > 0, distinct for all keys of the set
+ */
+static inline size_t mph_index(const struct mph *mph, const void *key, size_t len) {
+  const struct mph_header *hdr = mph->hdr;
+  uint64_t h = jhash64(key, len, hdr->seed);
+  uint32_t bucket = mph_reduce(h >> 32, hdr->nbuckets);
+  uint32_t pos = __mph_position(h, __mph_pilot(mph, bucket), hdr->size);
+
+  return pos < hdr->n ? pos : mph->remap[pos - hdr->n];
+}
+
+/**
+ * Returns the serialized form of the function.
+ *
+ * @param mph perfect hash function
+ * @return start of mph_serialized_size() bytes
+ */
+static inline const void *mph_serialized(const struct mph *mph) {
+  return mph->hdr;
+}
+
+#endif // MPH_H_
@@ -0,0 +1,823 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OHTABLE_H_
+#define OHTABLE_H_
+
+#include "hash.h"
+#include "hugepage.h"
+#include "jhash.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Open addressing hash table with per-slot control bytes.
+ *
+ * Every slot has a control byte which is either empty, deleted or holds
+ * the low 7 bits of the entry hash. Lookups compare a whole group of
+ * control bytes against the hash fingerprint at once and only dereference
+ * entries whose fingerprint matches, so a miss usually touches a single
+ * cache line of control bytes. The control array is followed by a copy of
+ * its first group so that groups can be loaded at any slot position.
+ */
+
+/** Control byte of a slot which has never been used */
+#define OHTABLE_EMPTY ((int8_t)-128)
+/** Control byte of a slot whose entry has been removed */
+#define OHTABLE_DELETED ((int8_t)-2)
+
+#ifdef __SSE2__
+/** Number of control bytes examined at once */
+#define OHTABLE_GROUP_WIDTH 16
+typedef uint32_t ohtable_mask_t;
+#else
+#define OHTABLE_GROUP_WIDTH 8
+typedef uint64_t ohtable_mask_t;
+#endif
+
+/** Default number of slots */
+#define OHTABLE_NUM_SLOTS 16
+
+/** Allocate control and slot arrays with hugepage_alloc() */
+#define OHTABLE_HUGE_PAGES 0x1
+
+/** Hash table entry identified by key */
+struct ohtable_entry {
+  /** Pointer to enclosing struct's key */
+  void *key;
+  /** Enclosing struct's key length */
+  size_t len;
+  /** Result of hash function applied to key */
+  unsigned hash;
+};
+
+/** Open addressing hash table */
+struct ohtable {
+  /** Control bytes followed by a copy of the first group */
+  int8_t *ctrl;
+  /** Slots containing table elements */
+  struct ohtable_entry **slots;
+  /** Number of allocated slots */
+  size_t size;
+  /** Number of entries in the table */
+  size_t count;
+  /** Number of slots which can be filled before the table is rehashed */
+  size_t growth_left;
+  /** OHTABLE_* allocation flags */
+  unsigned flags;
+};
+
+#define ohtable_h1(hash) ((hash) >> 7)
+#define ohtable_h2(hash) ((int8_t)((hash) & 0x7f))
+#define ohtable_ctrl_full(ctrl) ((ctrl) >= 0)
+
+/** Maximum number of used slots, keeps the load factor at 7/8 */
+#define ohtable_capacity(size) ((size) - (size) / 8)
+
+#ifdef __SSE2__
+
+static inline ohtable_mask_t ohtable_group_match(const int8_t *ctrl, int8_t h2) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), group));
+}
+
+static inline ohtable_mask_t ohtable_group_match_empty(const int8_t *ctrl) {
+  return ohtable_group_match(ctrl, OHTABLE_EMPTY);
+}
+
+static inline ohtable_mask_t ohtable_group_match_free(const int8_t *ctrl) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(group);
+}
+
+#define ohtable_mask_index(mask) __builtin_ctz(mask)
+
+#else
+
+#define OHTABLE_LSBS 0x0101010101010101ULL
+#define OHTABLE_MSBS 0x8080808080808080ULL
+
+static inline uint64_t ohtable_group_load(const int8_t *ctrl) {
+  uint64_t group;
+  memcpy(&group, ctrl, sizeof(group));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+
+/* May report false positives, every match is verified against the entry */
+static inline ohtable_mask_t ohtable_group_match(const int8_t *ctrl, int8_t h2) {
+  uint64_t x = ohtable_group_load(ctrl) ^ (OHTABLE_LSBS * (uint8_t)h2);
+  return (x - OHTABLE_LSBS) & ~x & OHTABLE_MSBS;
+}
+
+static inline ohtable_mask_t ohtable_group_match_empty(const int8_t *ctrl) {
+  uint64_t group = ohtable_group_load(ctrl);
+  return (group & (~group << 6)) & OHTABLE_MSBS;
+}
+
+static inline ohtable_mask_t ohtable_group_match_free(const int8_t *ctrl) {
+  return ohtable_group_load(ctrl) & OHTABLE_MSBS;
+}
+
+#define ohtable_mask_index(mask) (__builtin_ctzll(mask) >> 3)
+
+#endif
+
+/** Clear the lowest set position in the group mask */
+#define ohtable_mask_next(mask) ((mask) &= (mask) - 1)
+
+/**
+ * Set slot control byte, keeping the trailing copy of the first group.
+ *
+ * @param table hash table
+ * @param i slot index
+ * @param ctrl control byte
+ */
+static inline void ohtable_set_ctrl(struct ohtable *table, size_t i, int8_t ctrl) {
+  table->ctrl[i] = ctrl;
+  if (i < OHTABLE_GROUP_WIDTH) {
+    table->ctrl[table->size + i] = ctrl;
+  }
+}
+
+/**
+ * Get the entry stored in a slot.
+ *
+ * @param table hash table
+ * @param i slot index
+ * @return entry or NULL if the slot is not used
+ */
+static inline struct ohtable_entry *ohtable_slot(const struct ohtable *table, size_t i) {
+  return ohtable_ctrl_full(table->ctrl[i]) ? table->slots[i] : NULL;
+}
+
+/**
+ * Initialize new hash table entry.
+ */
+static inline void INIT_OHTABLE_ENTRY(struct ohtable_entry *entry, void *key, size_t len) {
+  entry->key = key;
+  entry->len = len;
+}
+
+/**
+ * Allocate the memory holding control bytes and slots.
+ *
+ * @param flags OHTABLE_* allocation flags
+ * @param len number of bytes
+ * @return memory or NULL
+ */
+static inline void *__ohtable_alloc_mem(unsigned flags, size_t len) {
+  if (flags & OHTABLE_HUGE_PAGES) {
+    return hugepage_alloc(len);
+  }
+  return malloc(len);
+}
+
+/**
+ * Free memory allocated by __ohtable_alloc_mem().
+ *
+ * @param flags OHTABLE_* allocation flags
+ * @param mem memory, may be NULL
+ * @param len number of bytes
+ */
+static inline void __ohtable_free_mem(unsigned flags, void *mem, size_t len) {
+  if (flags & OHTABLE_HUGE_PAGES) {
+    hugepage_free(mem, len);
+  } else {
+    free(mem);
+  }
+}
+
+/** Bytes of control bytes, padded to align the slot array */
+#define ohtable_ctrl_size(size, align) ALIGN((size) + OHTABLE_GROUP_WIDTH, (align))
+/** Bytes of control bytes and slots of a table */
+#define ohtable_mem_size(size) \
+  (ohtable_ctrl_size(size, sizeof(void *)) + sizeof(struct ohtable_entry *) * (size))
+
+static inline int __ohtable_alloc(struct ohtable *table, size_t size) {
+  size_t ctrl_size = ohtable_ctrl_size(size, sizeof(void *));
+  char *mem = (char *)__ohtable_alloc_mem(table->flags, ohtable_mem_size(size));
+  if (!mem) {
+    return -1;
+  }
+
+  table->ctrl = (int8_t *)mem;
+  table->slots = (struct ohtable_entry **)(mem + ctrl_size);
+  table->size = size;
+  table->growth_left = ohtable_capacity(size);
+  memset(table->ctrl, OHTABLE_EMPTY, size + OHTABLE_GROUP_WIDTH);
+
+  return 0;
+}
+
+/**
+ * Initialize new table of given size with allocation flags.
+ *
+ * With OHTABLE_HUGE_PAGES, the control and slot arrays of large tables are
+ * placed in huge pages, like the bucket arrays of HTABLE_HUGE_PAGES tables.
+ *
+ * @param table hash table
+ * @param n expected number of entries
+ * @param flags OHTABLE_* allocation flags
+ */
+static inline int ohtable_init_flags(struct ohtable *table, size_t n, unsigned flags) {
+  if (!table) {
+    return -1;
+  }
+
+  size_t size = OHTABLE_NUM_SLOTS;
+  while (ohtable_capacity(size) < n) {
+    size <<= 1;
+  }
+
+  table->count = 0;
+  table->flags = flags;
+  if (__ohtable_alloc(table, size) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Initialize new table of given size.
+ *
+ * @param table hash table
+ * @param n expected number of entries
+ */
+static inline int ohtable_init_n(struct ohtable *table, size_t n) {
+  return ohtable_init_flags(table, n, 0);
+}
+
+/**
+ * Initialize new hash table.
+ *
+ * @param table hash table
+ */
+static inline int ohtable_init(struct ohtable *table) {
+  return ohtable_init_n(table, 0);
+}
+
+/**
+ * Destroy hash table.
+ *
+ * @param table hash table
+ */
+static inline void ohtable_destroy(struct ohtable *table) {
+  if (table && table->ctrl) {
+    __ohtable_free_mem(table->flags, table->ctrl, ohtable_mem_size(table->size));
+    table->ctrl = NULL;
+    table->slots = NULL;
+  }
+}
+
+/**
+ * Find the first free slot on the probe sequence of the hash.
+ *
+ * @param table hash table
+ * @param hash hash of the key
+ * @return slot index
+ */
+static inline size_t __ohtable_find_free(const struct ohtable *table, unsigned hash) {
+  size_t mask = table->size - 1;
+  size_t pos = ohtable_h1(hash) & mask;
+
+  for (size_t step = OHTABLE_GROUP_WIDTH; ; step += OHTABLE_GROUP_WIDTH) {
+    ohtable_mask_t m = ohtable_group_match_free(&table->ctrl[pos]);
+    if (m) {
+      return (pos + ohtable_mask_index(m)) & mask;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+/**
+ * Move all entries into a slot array of the given size.
+ *
+ * This also drops all deleted markers when the size does not change.
+ *
+ * @param table hash table
+ * @param size new number of slots, must be a power of two
+ * @return 0 on success, -1 otherwise
+ */
+static inline int ohtable_resize(struct ohtable *table, size_t size) {
+  struct ohtable old = *table;
+
+  if (size < OHTABLE_NUM_SLOTS || ohtable_capacity(size) < table->count) {
+    return -1;
+  }
+  if (__ohtable_alloc(table, size) < 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < old.size; ++i) {
+    if (ohtable_ctrl_full(old.ctrl[i])) {
+      struct ohtable_entry *e = old.slots[i];
+      size_t j = __ohtable_find_free(table, e->hash);
+      ohtable_set_ctrl(table, j, ohtable_h2(e->hash));
+      table->slots[j] = e;
+    }
+  }
+  table->growth_left -= table->count;
+
+  __ohtable_free_mem(old.flags, old.ctrl, ohtable_mem_size(old.size));
+
+  return 0;
+}
+
+/**
+ * Add a new entry into hash table.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ * @return 0 on success, -1 if the table could not grow
+ */
+static inline int ohtable_add(struct ohtable *table, struct ohtable_entry *entry, void *key, size_t len) {
+  INIT_OHTABLE_ENTRY(entry, key, len);
+
+  unsigned hash = jhash(key, len, 0);
+  entry->hash = hash;
+
+  size_t i = __ohtable_find_free(table, hash);
+  if (table->growth_left == 0 && table->ctrl[i] == OHTABLE_EMPTY) {
+    // Reclaim deleted slots when they make up most of the load
+    size_t size = table->count * 2 > ohtable_capacity(table->size) ?
+      table->size << 1 : table->size;
+    if (ohtable_resize(table, size) < 0) {
+      return -1;
+    }
+    i = __ohtable_find_free(table, hash);
+  }
+
+  if (table->ctrl[i] == OHTABLE_EMPTY) {
+    table->growth_left--;
+  }
+  ohtable_set_ctrl(table, i, ohtable_h2(hash));
+  table->slots[i] = entry;
+
+  table->count++;
+  return 0;
+}
+
+/**
+ * Find the slot holding the key.
+ *
+ * @param table hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key
+ * @return slot index, or table size if the key is not present
+ */
+static inline size_t __ohtable_find_slot(const struct ohtable *table, const void *key, size_t len, unsigned hash) {
+  size_t mask = table->size - 1;
+  size_t pos = ohtable_h1(hash) & mask;
+  int8_t h2 = ohtable_h2(hash);
+
+  for (size_t step = OHTABLE_GROUP_WIDTH; ; step += OHTABLE_GROUP_WIDTH) {
+    const int8_t *ctrl = &table->ctrl[pos];
+    ohtable_mask_t m = ohtable_group_match(ctrl, h2);
+    for (; m; ohtable_mask_next(m)) {
+      size_t i = (pos + ohtable_mask_index(m)) & mask;
+      struct ohtable_entry *e = table->slots[i];
+      if (ohtable_ctrl_full(table->ctrl[i]) && e->hash == hash &&
+          e->len == len && memcmp(e->key, key, len) == 0) {
+        return i;
+      }
+    }
+    if (ohtable_group_match_empty(ctrl)) {
+      return table->size;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param table the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+static inline struct ohtable_entry *ohtable_find(const struct ohtable *table, const void *key, size_t len) {
+  size_t i = __ohtable_find_slot(table, key, len, jhash(key, len, 0));
+  return i < table->size ? table->slots[i] : NULL;
+}
+
+static inline void __ohtable_del_slot(struct ohtable *table, size_t i) {
+  ohtable_set_ctrl(table, i, OHTABLE_DELETED);
+  table->count--;
+}
+
+/**
+ * Remove entry with the given key from hash table.
+ *
+ * @param table the hash table to remove entry from
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if the key was not found
+ */
+static inline struct ohtable_entry *ohtable_del_key(struct ohtable *table, const void *key, size_t len) {
+  size_t i = __ohtable_find_slot(table, key, len, jhash(key, len, 0));
+  if (i < table->size) {
+    struct ohtable_entry *entry = table->slots[i];
+    __ohtable_del_slot(table, i);
+    return entry;
+  }
+  return NULL;
+}
+
+/**
+ * Remove entry previously added to the hash table.
+ *
+ * @param table the hash table to remove entry from
+ * @param entry the hash entry
+ * @return the removed entry, NULL if it was not in the table
+ */
+static inline struct ohtable_entry *ohtable_del_entry(struct ohtable *table, struct ohtable_entry *entry) {
+  size_t mask = table->size - 1;
+  size_t pos = ohtable_h1(entry->hash) & mask;
+  int8_t h2 = ohtable_h2(entry->hash);
+
+  for (size_t step = OHTABLE_GROUP_WIDTH; ; step += OHTABLE_GROUP_WIDTH) {
+    const int8_t *ctrl = &table->ctrl[pos];
+    ohtable_mask_t m = ohtable_group_match(ctrl, h2);
+    for (; m; ohtable_mask_next(m)) {
+      size_t i = (pos + ohtable_mask_index(m)) & mask;
+      if (ohtable_ctrl_full(table->ctrl[i]) && table->slots[i] == entry) {
+        __ohtable_del_slot(table, i);
+        return entry;
+      }
+    }
+    if (ohtable_group_match_empty(ctrl)) {
+      return NULL;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+/**
+ * Get the user data for this entry.
+ *
+ * @param ptr the hash table pointer
+ * @param type the type of the user data embedded in this entry
+ * @param member the name of the entry within the struct
+ */
+#define ohash_entry(ptr, type, member) \
+  container_of(ptr, type, member)
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * @param member the name of the entry within the struct
+ */
+#define ohash_find_entry(table, key, len, type, member) ({ \
+    struct ohtable_entry *e = ohtable_find((table), (key), (len)); \
+    (type *)(e ? ohash_entry(e, type, member) : NULL); })
+
+/**
+ * Iterate over hash table elements.
+ *
+ * Entries may be removed from the table while iterating.
+ *
+ * @param pos struct ohtable entry to use as a loop counter
+ * @param table your table
+ */
+#define ohtable_for_each(pos, table) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    for (pos = ohtable_slot((table), i); pos; pos = NULL)
+
+/**
+ * Iterate over hash table elements of given type.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos entry pointer to use as a loop cursor
+ * @param table your table
+ * @param member the name of the enry within the struct
+ */
+#define ohtable_for_each_entry(tpos, pos, table, member) \
+  for (size_t i = 0; i < (table)->size; ++i) \
+    for (pos = ohtable_slot((table), i); \
+         pos && ({ tpos = ohash_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = NULL)
+
+/*
+ * Type specialized hash maps.
+ *
+ * DEFINE_HTABLE() generates a map type for given key and value types along
+ * with named static inline functions operating on it, so hashing and key
+ * comparison inline fully. Keys and values are stored inline in the slot
+ * array, which is probed like ohtable using control bytes.
+ *
+ * The hash function result is spread with hash_mix64(), so identity hashes
+ * of strided integer keys do not cluster. The slot index is taken from the
+ * top of the spread hash and the control byte fingerprint from the bits
+ * right below.
+ */
+
+/** Spread the result of a map hash function */
+#define ohtable_map_hash(hash) hash_mix64((uint64_t)(hash))
+/** Slot index of a hash in a map of 1 << (64 - shift) slots */
+#define ohtable_map_h1(hash, shift) ((size_t)((hash) >> (shift)))
+/** Control byte fingerprint of a hash */
+#define ohtable_map_h2(hash, shift) ((int8_t)(((hash) >> ((shift) - 7)) & 0x7f))
+
+/**
+ * Iterate over the slots of a map holding an entry.
+ *
+ * Entries may be removed from the map while iterating.
+ *
+ * @param pos slot pointer to use as a loop cursor, pos->key and pos->val
+ *        are the entry key and value
+ * @param map your map
+ */
+#define ohtable_map_for_each(pos, map) \
+  for (size_t i = 0; i < (map)->size; ++i) \
+    for (pos = ohtable_ctrl_full((map)->ctrl[i]) ? &(map)->slots[i] : NULL; pos; pos = NULL)
+
+/**
+ * Define a hash map type and its functions.
+ *
+ * The generated functions are prefixed with the map name:
+ *
+ *   int name_init(struct name *map)
+ *   int name_init_n(struct name *map, size_t n)
+ *   int name_init_flags(struct name *map, size_t n, unsigned flags)
+ *   void name_destroy(struct name *map)
+ *   size_t name_count(const struct name *map)
+ *   int name_resize(struct name *map, size_t size)
+ *   val_t *name_find(const struct name *map, key_t key)
+ *   int name_put(struct name *map, key_t key, val_t val)
+ *   int name_del(struct name *map, key_t key, val_t *val)
+ *
+ * Example:
+ *
+ *   #define str_hash(s) jhash((s), strlen(s), 0)
+ *   #define str_eq(a, b) (strcmp((a), (b)) == 0)
+ *   DEFINE_HTABLE(strmap, const char *, int, str_hash, str_eq)
+ *
+ * @param name name of the map type
+ * @param key_t key type
+ * @param val_t value type
+ * @param hash_fn function or macro hashing a key to an integer
+ * @param eq_fn function or macro returning non zero for equal keys
+ */
+#define DEFINE_HTABLE(name, key_t, val_t, hash_fn, eq_fn) \
+  \
+  /** Slot of name, an entry when its control byte is full */ \
+  struct name##_slot { \
+    key_t key; \
+    val_t val; \
+  }; \
+  \
+  /** Hash map */ \
+  struct name { \
+    /** Control bytes followed by a copy of the first group */ \
+    int8_t *ctrl; \
+    /** Slots holding keys and values */ \
+    struct name##_slot *slots; \
+    /** Number of allocated slots */ \
+    size_t size; \
+    /** Number of entries in the map */ \
+    size_t count; \
+    /** Number of slots which can be filled before the map is rehashed */ \
+    size_t growth_left; \
+    /** Hash shift giving the slot index, 64 - log2(size) */ \
+    unsigned shift; \
+    /** OHTABLE_* allocation flags */ \
+    unsigned flags; \
+  }; \
+  \
+  static inline void __##name##_set_ctrl(struct name *map, size_t i, int8_t ctrl) { \
+    map->ctrl[i] = ctrl; \
+    if (i < OHTABLE_GROUP_WIDTH) { \
+      map->ctrl[map->size + i] = ctrl; \
+    } \
+  } \
+  \
+  static inline size_t __##name##_mem_size(size_t size) { \
+    return ohtable_ctrl_size(size, __alignof__(struct name##_slot)) + sizeof(struct name##_slot) * size; \
+  } \
+  \
+  static inline int __##name##_alloc(struct name *map, size_t size) { \
+    size_t ctrl_size = ohtable_ctrl_size(size, __alignof__(struct name##_slot)); \
+    char *mem = (char *)__ohtable_alloc_mem(map->flags, __##name##_mem_size(size)); \
+    if (!mem) { \
+      return -1; \
+    } \
+    \
+    map->ctrl = (int8_t *)mem; \
+    map->slots = (struct name##_slot *)(mem + ctrl_size); \
+    map->size = size; \
+    map->growth_left = ohtable_capacity(size); \
+    map->shift = 64 - __builtin_ctzll(size); \
+    memset(map->ctrl, OHTABLE_EMPTY, size + OHTABLE_GROUP_WIDTH); \
+    \
+    return 0; \
+  } \
+  \
+  /**
+   * Initialize new map sized for n entries with OHTABLE_* allocation flags.
+   */ \
+  static inline int name##_init_flags(struct name *map, size_t n, unsigned flags) { \
+    size_t size = OHTABLE_NUM_SLOTS; \
+    while (ohtable_capacity(size) < n) { \
+      size <<= 1; \
+    } \
+    \
+    map->count = 0; \
+    map->flags = flags; \
+    return __##name##_alloc(map, size); \
+  } \
+  \
+  /**
+   * Initialize new map sized for n entries.
+   */ \
+  static inline int name##_init_n(struct name *map, size_t n) { \
+    return name##_init_flags(map, n, 0); \
+  } \
+  \
+  /**
+   * Initialize new map.
+   */ \
+  static inline int name##_init(struct name *map) { \
+    return name##_init_n(map, 0); \
+  } \
+  \
+  /**
+   * Destroy map.
+   */ \
+  static inline void name##_destroy(struct name *map) { \
+    __ohtable_free_mem(map->flags, map->ctrl, __##name##_mem_size(map->size)); \
+    map->ctrl = NULL; \
+    map->slots = NULL; \
+  } \
+  \
+  /**
+   * Returns the number of entries in the map.
+   */ \
+  static inline size_t name##_count(const struct name *map) { \
+    return map->count; \
+  } \
+  \
+  static inline size_t __##name##_find_free(const struct name *map, uint64_t hash) { \
+    size_t mask = map->size - 1; \
+    size_t pos = ohtable_map_h1(hash, map->shift); \
+    \
+    for (size_t step = OHTABLE_GROUP_WIDTH; ; step += OHTABLE_GROUP_WIDTH) { \
+      ohtable_mask_t m = ohtable_group_match_free(&map->ctrl[pos]); \
+      if (m) { \
+        return (pos + ohtable_mask_index(m)) & mask; \
+      } \
+      pos = (pos + step) & mask; \
+    } \
+  } \
+  \
+  /**
+   * Find the slot holding the key, or map size if the key is not present.
+   */ \
+  static inline size_t __##name##_find_slot(const struct name *map, key_t key, uint64_t hash) { \
+    size_t mask = map->size - 1; \
+    size_t pos = ohtable_map_h1(hash, map->shift); \
+    int8_t h2 = ohtable_map_h2(hash, map->shift); \
+    \
+    for (size_t step = OHTABLE_GROUP_WIDTH; ; step += OHTABLE_GROUP_WIDTH) { \
+      const int8_t *ctrl = &map->ctrl[pos]; \
+      ohtable_mask_t m = ohtable_group_match(ctrl, h2); \
+      for (; m; ohtable_mask_next(m)) { \
+        size_t i = (pos + ohtable_mask_index(m)) & mask; \
+        if (ohtable_ctrl_full(map->ctrl[i]) && eq_fn(map->slots[i].key, key)) { \
+          return i; \
+        } \
+      } \
+      if (ohtable_group_match_empty(ctrl)) { \
+        return map->size; \
+      } \
+      pos = (pos + step) & mask; \
+    } \
+  } \
+  \
+  /**
+   * Move all entries into a slot array of the given size.
+   */ \
+  static inline int name##_resize(struct name *map, size_t size) { \
+    struct name old = *map; \
+    \
+    if (size < OHTABLE_NUM_SLOTS || ohtable_capacity(size) < map->count) { \
+      return -1; \
+    } \
+    if (__##name##_alloc(map, size) < 0) { \
+      return -1; \
+    } \
+    \
+    for (size_t i = 0; i < old.size; ++i) { \
+      if (ohtable_ctrl_full(old.ctrl[i])) { \
+        uint64_t hash = ohtable_map_hash(hash_fn(old.slots[i].key)); \
+        size_t j = __##name##_find_free(map, hash); \
+        __##name##_set_ctrl(map, j, ohtable_map_h2(hash, map->shift)); \
+        map->slots[j] = old.slots[i]; \
+      } \
+    } \
+    map->growth_left -= map->count; \
+    \
+    __ohtable_free_mem(old.flags, old.ctrl, __##name##_mem_size(old.size)); \
+    \
+    return 0; \
+  } \
+  \
+  /**
+   * Looks up the map for the presence of key.
+   *
+   * @return pointer to the value of the key, NULL if not found
+   */ \
+  static inline val_t *name##_find(const struct name *map, key_t key) { \
+    size_t i = __##name##_find_slot(map, key, ohtable_map_hash(hash_fn(key))); \
+    return i < map->size ? &map->slots[i].val : NULL; \
+  } \
+  \
+  /**
+   * Set the value of key, adding it to the map if not present.
+   *
+   * @return 0 if the key was added, 1 if its value was replaced,
+   *         -1 if the map could not grow
+   */ \
+  static inline int name##_put(struct name *map, key_t key, val_t val) { \
+    uint64_t hash = ohtable_map_hash(hash_fn(key)); \
+    size_t i = __##name##_find_slot(map, key, hash); \
+    \
+    if (i < map->size) { \
+      map->slots[i].val = val; \
+      return 1; \
+    } \
+    \
+    i = __##name##_find_free(map, hash); \
+    if (map->growth_left == 0 && map->ctrl[i] == OHTABLE_EMPTY) { \
+      /* Reclaim deleted slots when they make up most of the load */ \
+      size_t size = map->count * 2 > ohtable_capacity(map->size) ? \
+        map->size << 1 : map->size; \
+      if (name##_resize(map, size) < 0) { \
+        return -1; \
+      } \
+      i = __##name##_find_free(map, hash); \
+    } \
+    \
+    if (map->ctrl[i] == OHTABLE_EMPTY) { \
+      map->growth_left--; \
+    } \
+    __##name##_set_ctrl(map, i, ohtable_map_h2(hash, map->shift)); \
+    map->slots[i].key = key; \
+    map->slots[i].val = val; \
+    map->count++; \
+    \
+    return 0; \
+  } \
+  \
+  /**
+   * Remove key from the map.
+   *
+   * @param val if not NULL, receives the value of the removed key
+   * @return 0 if the key was removed, -1 if it was not found
+   */ \
+  static inline int name##_del(struct name *map, key_t key, val_t *val) { \
+    size_t i = __##name##_find_slot(map, key, ohtable_map_hash(hash_fn(key))); \
+    \
+    if (i == map->size) { \
+      return -1; \
+    } \
+    if (val) { \
+      *val = map->slots[i].val; \
+    } \
+    __##name##_set_ctrl(map, i, OHTABLE_DELETED); \
+    map->count--; \
+    \
+    return 0; \
+  }
+
+
+#endif // OHTABLE_H_
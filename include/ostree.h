@@ -0,0 +1,119 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSTREE_H_
+#define OSTREE_H_
+
+#include "rbtree.h"
+
+#include <stddef.h>
+
+/*
+ * Order statistic tree.
+ *
+ * A red black tree whose nodes also count the nodes of their subtree, so
+ * the position of a node in rb_next() order (its rank) and the node at a
+ * given position are found in logarithmic time. The counts are kept up to
+ * date through rb_insert_augmented() and rb_erase_augmented(), ordinary
+ * rb_* functions which do not change the tree shape work unchanged.
+ *
+ * Example, with the ordering of rb_insert():
+ *
+ *   struct timer { uint64_t expires; struct ost_node node; };
+ *
+ *   ost_insert(&root, struct timer, node, expires, t, cmp);
+ *   size_t pending_before = ost_rank(&t->node);
+ *   struct ost_node *median = ost_select(&root, ost_count(&root) / 2);
+ */
+
+/** Order statistic tree node */
+struct ost_node {
+    struct rb_node rb;
+    /** Number of nodes in the subtree rooted at this node */
+    size_t size;
+};
+
+/* Externals are commented with implementation */
+extern void ost_link(struct ost_node *node, struct rb_node *parent, struct rb_node **link,
+        struct rb_root *root);
+extern void ost_erase(struct ost_node *node, struct rb_root *root);
+extern size_t ost_rank(const struct ost_node *node);
+extern struct ost_node *ost_select(const struct rb_root *root, size_t k);
+
+/**
+ * Get the order statistic node of a tree node.
+ *
+ * @param node tree node, may be NULL
+ */
+static inline struct ost_node *ost_node(const struct rb_node *node) {
+    return node ? rb_entry(node, struct ost_node, rb) : NULL;
+}
+
+/**
+ * Number of nodes in a subtree.
+ *
+ * @param node subtree root, may be NULL
+ */
+static inline size_t ost_size(const struct rb_node *node) {
+    return node ? ost_node(node)->size : 0;
+}
+
+/**
+ * Number of nodes in the tree.
+ *
+ * @param root tree root
+ */
+static inline size_t ost_count(const struct rb_root *root) {
+    return ost_size(root->rb_node);
+}
+
+/**
+ * Add node to order statistic tree.
+ *
+ * Descends the tree like rb_insert(), nodes with the same key as item are
+ * left alone.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the struct ost_node within the struct
+ * @param key name of the key item within the struct
+ * @param item pointer to the struct to insert into the tree
+ * @param cmp comparison function
+ * @return NULL if item was added, the item with the same key otherwise
+ */
+#define ost_insert(root, type, member, key, item, cmp) ({ \
+        struct rb_node **new = &(root)->rb_node, *parent = NULL; \
+        type *__item = (item), *__dup = NULL; \
+        while (*new) { \
+            int result = cmp(rb_entry(*new, type, member.rb)->key, __item->key); \
+            parent = *new; \
+            if (result < 0) { \
+                new = &((*new)->rb_left); \
+            } else if (result > 0) { \
+                new = &((*new)->rb_right); \
+            } else { \
+                __dup = rb_entry(*new, type, member.rb); \
+                break; \
+            } \
+        } \
+        if (!__dup) { \
+            ost_link(&__item->member, parent, new, (root)); \
+        } \
+        __dup; \
+    })
+
+#endif // OSTREE_H_
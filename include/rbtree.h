@@ -20,6 +20,7 @@
 
 #include "kernel.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /** Red Black tree node */
@@ -85,6 +86,26 @@ static inline void rb_init_node(struct rb_node *rb) {
 extern void rb_insert_color(struct rb_node *node, struct rb_root *root);
 extern void rb_erase(struct rb_node *node, struct rb_root *root);
 
+/**
+ * Callbacks maintaining per-node augmented values, such as subtree sizes.
+ *
+ * propagate recomputes the value of node and its ancestors up to, but not
+ * including, stop, and must return early once a recomputed value does not
+ * change. copy gives the value of old to new, which replaces it in the
+ * tree. rotate is called after new has been rotated into the place of old,
+ * it gives the value of old to new and recomputes the one of old.
+ */
+struct rb_augment_callbacks {
+    void (*propagate)(struct rb_node *node, struct rb_node *stop);
+    void (*copy)(struct rb_node *old, struct rb_node *new);
+    void (*rotate)(struct rb_node *old, struct rb_node *new);
+};
+
+extern void rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment);
+extern void rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment);
+
 typedef void (*rb_augment_f)(struct rb_node *node, void *data);
 
 extern void rb_augment_insert(struct rb_node *node, rb_augment_f func, void *data);
@@ -98,6 +119,28 @@ extern struct rb_node *rb_last(struct rb_root *root);
 
 extern void rb_replace_node(struct rb_node *victim, struct rb_node *new,  struct rb_root *root);
 
+struct list_head;
+
+extern void rb_build(struct rb_root *root, struct rb_node **nodes, size_t n);
+extern void rb_build_list(struct rb_root *root, struct list_head *head, ptrdiff_t offset);
+extern void rb_append(struct rb_root *root, struct rb_node **nodes, size_t n);
+extern size_t rb_erase_range(struct rb_root *root, struct rb_node *first, struct rb_node *end,
+        struct rb_node **erased);
+extern void rb_merge(struct rb_root *root, struct rb_node **nodes, size_t n,
+        int (*cmp)(const struct rb_node *a, const struct rb_node *b));
+
+/**
+ * Build a tree from a sorted list of entries in linear time.
+ *
+ * @param root tree root, any previous content is dropped
+ * @param head list of entries in the order rb_next() is to visit them
+ * @param type type of the entries
+ * @param list_member name of the struct list_head within the struct
+ * @param rb_member name of the struct rb_node within the struct
+ */
+#define rb_build_list_entry(root, head, type, list_member, rb_member) \
+    rb_build_list(root, head, (ptrdiff_t)offsetof(type, rb_member) - (ptrdiff_t)offsetof(type, list_member))
+
 /**
  * Link node with given node in red black tree.
  *
@@ -200,6 +243,331 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
         } \
     })
 
+/**
+ * Find the first node whose key does not come before value.
+ *
+ * For a tree in increasing key order, the first node with key >= value.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the tree structure within the struct
+ * @param key name of the key item within the struct
+ * @param value value to look for in the tree
+ * @param cmp comparison function
+ * @return found node or NULL if all keys come before value
+ */
+#define rb_lower_bound(root, type, member, key, value, cmp) ({ \
+        struct rb_node *node = (root)->rb_node, *bound = NULL; \
+        while (node) { \
+            if (cmp(rb_entry(node, type, member)->key, value) <= 0) { \
+                bound = node; \
+                node = node->rb_left; \
+            } else { \
+                node = node->rb_right; \
+            } \
+        } \
+        bound; \
+    })
+
+/**
+ * Find the first node whose key comes after value.
+ *
+ * For a tree in increasing key order, the first node with key > value.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the tree structure within the struct
+ * @param key name of the key item within the struct
+ * @param value value to look for in the tree
+ * @param cmp comparison function
+ * @return found node or NULL if no key comes after value
+ */
+#define rb_upper_bound(root, type, member, key, value, cmp) ({ \
+        struct rb_node *node = (root)->rb_node, *bound = NULL; \
+        while (node) { \
+            if (cmp(rb_entry(node, type, member)->key, value) < 0) { \
+                bound = node; \
+                node = node->rb_left; \
+            } else { \
+                node = node->rb_right; \
+            } \
+        } \
+        bound; \
+    })
+
+/**
+ * Delete the nodes with keys from lo up to, but not including, hi.
+ *
+ * Both bounds are found with a single descent each, see rb_erase_range().
+ * Nothing is deleted unless lo comes before hi.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the tree structure within the struct
+ * @param key name of the key item within the struct
+ * @param lo first key of the range
+ * @param hi first key past the range
+ * @param cmp comparison function
+ * @param erased if not NULL, receives the chain of deleted nodes
+ * @return number of deleted nodes
+ */
+#define rb_delete_range(root, type, member, key, lo, hi, cmp, erased) ({ \
+        struct rb_node *first = rb_lower_bound(root, type, member, key, lo, cmp); \
+        struct rb_node *end = cmp(lo, hi) > 0 ? \
+            rb_lower_bound(root, type, member, key, hi, cmp) : first; \
+        rb_erase_range(root, first, end, erased); \
+    })
+
+/**
+ * Red black tree root caching its first and last nodes.
+ *
+ * rb_first_cached() and rb_last_cached() are O(1), while rb_first() walks
+ * a spine of the tree. The cache is maintained by the *_cached variants of
+ * the functions changing the tree, all of which take the root below and
+ * must be used for every change of the tree.
+ */
+struct rb_root_cached {
+    struct rb_root rb_root;
+    struct rb_node *rb_leftmost;
+    struct rb_node *rb_rightmost;
+};
+
+#define RB_ROOT_CACHED (struct rb_root_cached) { { NULL, }, NULL, NULL }
+
+/** First node of the tree in rb_next() order, NULL if empty */
+#define rb_first_cached(root) ((root)->rb_leftmost)
+/** Last node of the tree in rb_next() order, NULL if empty */
+#define rb_last_cached(root) ((root)->rb_rightmost)
+
+/**
+ * Insert node into a caching tree and check colors.
+ *
+ * @param node node linked with rb_link_node()
+ * @param root tree root
+ * @param leftmost whether node was linked left of every node
+ * @param rightmost whether node was linked right of every node
+ */
+static inline void rb_insert_color_cached(struct rb_node *node, struct rb_root_cached *root,
+        bool leftmost, bool rightmost) {
+    if (leftmost)
+        root->rb_leftmost = node;
+    if (rightmost)
+        root->rb_rightmost = node;
+    rb_insert_color(node, &root->rb_root);
+}
+
+/**
+ * Erase node from a caching tree.
+ *
+ * @param node erased node
+ * @param root tree root
+ */
+static inline void rb_erase_cached(struct rb_node *node, struct rb_root_cached *root) {
+    if (root->rb_leftmost == node)
+        root->rb_leftmost = rb_next(node);
+    if (root->rb_rightmost == node)
+        root->rb_rightmost = rb_prev(node);
+    rb_erase(node, &root->rb_root);
+}
+
+/**
+ * Remove the first node from a caching tree.
+ *
+ * The next node is found from the removed one, which is at most a step
+ * up or down the tree on average.
+ *
+ * @param root tree root
+ * @return removed node, NULL if the tree is empty
+ */
+static inline struct rb_node *rb_pop_first_cached(struct rb_root_cached *root) {
+    struct rb_node *node = root->rb_leftmost;
+
+    if (node)
+        rb_erase_cached(node, root);
+    return node;
+}
+
+/**
+ * Replace a node of a caching tree with another one with the same key.
+ *
+ * @param victim node to replace
+ * @param new replacement node
+ * @param root tree root
+ */
+static inline void rb_replace_node_cached(struct rb_node *victim, struct rb_node *new,
+        struct rb_root_cached *root) {
+    if (root->rb_leftmost == victim)
+        root->rb_leftmost = new;
+    if (root->rb_rightmost == victim)
+        root->rb_rightmost = new;
+    rb_replace_node(victim, new, &root->rb_root);
+}
+
+/**
+ * Add node to a caching red black tree.
+ *
+ * Same as rb_insert(), nodes with the same key as item are left alone.
+ *
+ * @param root tree root
+ * @param type type of the struct this is embedded in
+ * @param member name of the list structure within the struct
+ * @param key name of the key item within the struct
+ * @param item item to insert into the tree
+ * @param cmp comparison function
+ */
+#define rb_insert_cached(root, type, member, key, item, cmp) ({ \
+        bool insert = true, leftmost = true, rightmost = true; \
+        struct rb_node **new = &((root)->rb_root.rb_node), *parent = NULL; \
+        while (*new) { \
+            int result = cmp(rb_entry(*new, type, member)->key, \
+                rb_entry(item, type, member)->key); \
+            parent = *new; \
+            if (result < 0) { \
+                new = &((*new)->rb_left); \
+                rightmost = false; \
+            } else if (result > 0) { \
+                new = &((*new)->rb_right); \
+                leftmost = false; \
+            } else { \
+                insert = false; \
+                break; \
+            } \
+        } \
+        if (insert) { \
+            rb_link_node(item, parent, new); \
+            rb_insert_color_cached(item, root, leftmost, rightmost); \
+        } \
+    })
+
+/** Type of the key member of a struct, arrays decay to pointers */
+#define __rb_key_t(type, key) typeof(((type *)0)->key + 0)
+
+/**
+ * Define typed red black tree functions for a struct type.
+ *
+ * Unlike rb_find() and rb_insert(), the generated functions are named
+ * static inline functions, so the comparison inlines into each of them and
+ * arguments are type checked. Trees are ordered the same way, cmp is
+ * called with the key of a node first and a result below zero descends
+ * left, so the generated functions can be mixed with the generic macros.
+ *
+ * The generated functions are prefixed with name:
+ *
+ *   type *name_find(struct rb_root *root, key_t value)
+ *   type *name_insert(struct rb_root *root, type *item)
+ *   type *name_delete(struct rb_root *root, key_t value)
+ *   type *name_lower_bound(struct rb_root *root, key_t value)
+ *   type *name_upper_bound(struct rb_root *root, key_t value)
+ *   type *name_first(struct rb_root *root)
+ *   type *name_last(struct rb_root *root)
+ *   type *name_next(type *item)
+ *   type *name_prev(type *item)
+ *
+ * where key_t is the type of the key member, decayed to a pointer for
+ * array keys.
+ *
+ * @param name prefix of the generated functions
+ * @param type type of the struct the tree nodes are embedded in
+ * @param member name of the struct rb_node within the struct
+ * @param key name of the key item within the struct
+ * @param cmp comparison function or macro
+ */
+#define DEFINE_RBTREE(name, type, member, key, cmp) \
+    \
+    static inline type *__##name##_entry(struct rb_node *node) { \
+        return node ? rb_entry(node, type, member) : NULL; \
+    } \
+    \
+    /**
+     * Look for value in the tree.
+     *
+     * @return found item or NULL
+     */ \
+    static inline type *name##_find(struct rb_root *root, __rb_key_t(type, key) value) { \
+        struct rb_node *node = root->rb_node; \
+        while (node) { \
+            int result = cmp(rb_entry(node, type, member)->key, value); \
+            if (result < 0) { \
+                node = node->rb_left; \
+            } else if (result > 0) { \
+                node = node->rb_right; \
+            } else { \
+                return rb_entry(node, type, member); \
+            } \
+        } \
+        return NULL; \
+    } \
+    \
+    /**
+     * Add item to the tree unless an item with the same key is present.
+     *
+     * @return NULL if item was added, the item with the same key otherwise
+     */ \
+    static inline type *name##_insert(struct rb_root *root, type *item) { \
+        struct rb_node **new = &root->rb_node, *parent = NULL; \
+        while (*new) { \
+            int result = cmp(rb_entry(*new, type, member)->key, item->key); \
+            parent = *new; \
+            if (result < 0) { \
+                new = &(*new)->rb_left; \
+            } else if (result > 0) { \
+                new = &(*new)->rb_right; \
+            } else { \
+                return rb_entry(*new, type, member); \
+            } \
+        } \
+        rb_link_node(&item->member, parent, new); \
+        rb_insert_color(&item->member, root); \
+        return NULL; \
+    } \
+    \
+    /**
+     * Remove the item with given key from the tree.
+     *
+     * @return removed item or NULL if not found
+     */ \
+    static inline type *name##_delete(struct rb_root *root, __rb_key_t(type, key) value) { \
+        type *item = name##_find(root, value); \
+        if (item) { \
+            rb_erase(&item->member, root); \
+        } \
+        return item; \
+    } \
+    \
+    /**
+     * Find the first item whose key does not come before value.
+     *
+     * @return found item or NULL
+     */ \
+    static inline type *name##_lower_bound(struct rb_root *root, __rb_key_t(type, key) value) { \
+        return __##name##_entry(rb_lower_bound(root, type, member, key, value, cmp)); \
+    } \
+    \
+    /**
+     * Find the first item whose key comes after value.
+     *
+     * @return found item or NULL
+     */ \
+    static inline type *name##_upper_bound(struct rb_root *root, __rb_key_t(type, key) value) { \
+        return __##name##_entry(rb_upper_bound(root, type, member, key, value, cmp)); \
+    } \
+    \
+    static inline type *name##_first(struct rb_root *root) { \
+        return __##name##_entry(rb_first(root)); \
+    } \
+    \
+    static inline type *name##_last(struct rb_root *root) { \
+        return __##name##_entry(rb_last(root)); \
+    } \
+    \
+    static inline type *name##_next(type *item) { \
+        return __##name##_entry(rb_next(&item->member)); \
+    } \
+    \
+    static inline type *name##_prev(type *item) { \
+        return __##name##_entry(rb_prev(&item->member)); \
+    }
+
 /**
  * Iterate over a red black tree.
  *
@@ -218,6 +586,44 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
 #define rb_for_each_prev(pos, root) \
     for (pos = rb_last(root); pos; pos = rb_prev(pos))
 
+/**
+ * Iterate over the nodes with keys from lo up to, but not including, hi.
+ *
+ * The first node is found with a single descent and the following ones
+ * with rb_next(), so visiting k nodes takes O(log n + k).
+ *
+ * @param pos struct tree node to use as a loop counter
+ * @param root root for your tree
+ * @param type type of the struct this is embedded in
+ * @param member name of the tree structure within the struct
+ * @param key name of the key item within the struct
+ * @param lo first key of the range
+ * @param hi first key past the range
+ * @param cmp comparison function
+ */
+#define rb_for_each_range(pos, root, type, member, key, lo, hi, cmp) \
+    for (pos = rb_lower_bound(root, type, member, key, lo, cmp); \
+         pos && cmp(rb_entry(pos, type, member)->key, hi) > 0; \
+         pos = rb_next(pos))
+
+/**
+ * Iterate over entries with keys from lo up to, but not including, hi.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos node pointer to use as a loop cursor
+ * @param root root for your tree
+ * @param member name of the tree structure within the struct
+ * @param key name of the key item within the struct
+ * @param lo first key of the range
+ * @param hi first key past the range
+ * @param cmp comparison function
+ */
+#define rb_for_each_entry_range(tpos, pos, root, member, key, lo, hi, cmp) \
+    for (pos = rb_lower_bound(root, typeof(*tpos), member, key, lo, cmp); \
+         pos && ({ tpos = rb_entry(pos, typeof(*tpos), member); 1; }) && \
+         cmp(tpos->key, hi) > 0; \
+         pos = rb_next(pos))
+
 /**
  * Iterate over a red black tree safe against removal of list entry
  *
@@ -0,0 +1,106 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RCULIST_H_
+#define RCULIST_H_
+
+#include "atomic.h"
+#include "hlist.h"
+
+/*
+ * List variants which may be traversed by readers concurrently with a
+ * single writer. Writers publish nodes with release stores and readers
+ * load the links with acquire loads. Removed nodes keep their next link,
+ * so a reader standing on one can still finish its walk; they must not be
+ * freed nor reused until all readers which might see them are gone.
+ */
+
+/**
+ * Load pointer published by rcu_assign_pointer.
+ *
+ * @param p pointer to load
+ */
+#define rcu_dereference(p) \
+    atomic_load_explicit((_Atomic(typeof(p)) *)&(p), memory_order_acquire)
+
+/**
+ * Publish pointer to concurrent readers.
+ *
+ * @param p pointer to assign to
+ * @param v new value
+ */
+#define rcu_assign_pointer(p, v) \
+    atomic_store_explicit((_Atomic(typeof(p)) *)&(p), (v), memory_order_release)
+
+/**
+ * Initialize pointer which readers may load, without ordering.
+ *
+ * Only for pointers which are published afterwards, or whose target
+ * readers cannot reach yet.
+ *
+ * @param p pointer to assign to
+ * @param v new value
+ */
+#define rcu_init_pointer(p, v) \
+    atomic_store_explicit((_Atomic(typeof(p)) *)&(p), (v), memory_order_relaxed)
+
+/**
+ * Add a new entry visible to concurrent readers.
+ *
+ * Insert a new entry after the specified head.
+ *
+ * @param n new entry to be added
+ * @param h list head to add it after
+ */
+static inline void hlist_add_head_rcu(struct hlist_node *n, struct hlist_head *h) {
+    struct hlist_node *first = h->first;
+    // Links are only accessed atomically, readers load them concurrently
+    rcu_init_pointer(n->next, first);
+    n->pprev = &h->first;
+    rcu_assign_pointer(h->first, n);
+    if (first)
+        first->pprev = &n->next;
+}
+
+/**
+ * Deletes entry from list, leaving its next link for concurrent readers.
+ *
+ * @param n element to delete from the list
+ */
+static inline void hlist_del_rcu(struct hlist_node *n) {
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+    rcu_assign_pointer(*pprev, next);
+    if (next)
+        next->pprev = pprev;
+    n->pprev = NULL;
+}
+
+/**
+ * Iterate over list of given type concurrently with a writer.
+ *
+ * @param tpos type pointer to use as a loop cursor
+ * @param pos node pointer to use as a loop cursor
+ * @param head head for your list
+ * @param member name of the list structure within the struct
+ */
+#define hlist_for_each_entry_rcu(tpos, pos, head, member) \
+    for (pos = rcu_dereference((head)->first); \
+         pos && ({ tpos = hlist_entry(pos, typeof(*tpos), member); 1;}); \
+         pos = rcu_dereference(pos->next))
+
+#endif // RCULIST_H_
@@ -0,0 +1,185 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bloom.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Compute optimal bloom filter dimensions.
+ *
+ * The filter uses m = -n ln(p) / ln(2)^2 bits and k = m / n ln(2) hash
+ * functions, which minimizes the false positive rate p for n elements.
+ *
+ * @param n expected number of elements
+ * @param fpr target false positive rate
+ * @param nhashes number of hash functions
+ * @return number of bits
+ */
+static size_t bloom_size(size_t n, double fpr, unsigned *nhashes) {
+    double m, k;
+
+    if (n == 0)
+        n = 1;
+
+    m = ceil(-(double)n * log(fpr) / (M_LN2 * M_LN2));
+    // Bit indexes are derived from 32-bit hashes
+    m = fmin(m, 4294967296.0);
+    k = round(m / n * M_LN2);
+
+    *nhashes = clamp((unsigned)k, 1U, (unsigned)BLOOM_MAX_HASHES);
+    return (size_t)m;
+}
+
+/**
+ * Initialize bloom filter for given number of elements.
+ *
+ * @param bf bloom filter
+ * @param n expected number of elements
+ * @param fpr target false positive rate
+ * @return 0 on success, -1 otherwise
+ */
+int bloom_init(struct bloom *bf, size_t n, double fpr) {
+    if (!bf || fpr <= 0.0 || fpr >= 1.0)
+        return -1;
+
+    bf->nbits = ALIGN(bloom_size(n, fpr, &bf->nhashes), BITS_PER_LONG);
+    bf->count = 0;
+    bf->bits = calloc(bf->nbits / BITS_PER_LONG, sizeof(unsigned long));
+    if (!bf->bits)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Destroy bloom filter.
+ *
+ * @param bf bloom filter
+ */
+void bloom_destroy(struct bloom *bf) {
+    if (bf && bf->bits) {
+        free(bf->bits);
+        bf->bits = NULL;
+    }
+}
+
+/**
+ * Remove all elements from bloom filter.
+ *
+ * @param bf bloom filter
+ */
+void bloom_clear(struct bloom *bf) {
+    memset(bf->bits, 0, bf->nbits / BITS_PER_BYTE);
+    bf->count = 0;
+}
+
+/**
+ * Returns the fraction of bits set in bloom filter.
+ *
+ * @param bf bloom filter
+ */
+double bloom_fill_ratio(const struct bloom *bf) {
+    size_t set = 0;
+
+    for (size_t i = 0; i < bf->nbits / BITS_PER_LONG; ++i)
+        set += hweight_long(bf->bits[i]);
+
+    return (double)set / bf->nbits;
+}
+
+/**
+ * Initialize counting bloom filter for given number of elements.
+ *
+ * Each counter takes four bits, the filter is thus four times larger than
+ * a plain bloom filter with the same false positive rate. Blocked filters
+ * take another 15% to make up for their higher false positive rate.
+ *
+ * @param cb counting bloom filter
+ * @param n expected number of elements
+ * @param fpr target false positive rate
+ * @param flags CBLOOM_BLOCKED for a cache-line blocked layout
+ * @return 0 on success, -1 otherwise
+ */
+int cbloom_init(struct cbloom *cb, size_t n, double fpr, unsigned flags) {
+    size_t size;
+
+    if (!cb || fpr <= 0.0 || fpr >= 1.0)
+        return -1;
+
+    // All counters of an element share a block, which about doubles the
+    // false positive rate, so blocked filters are sized for half of it
+    if (flags & CBLOOM_BLOCKED)
+        fpr /= 2;
+
+    cb->ncounters = bloom_size(n, fpr, &cb->nhashes);
+    cb->flags = flags;
+    cb->count = 0;
+
+    if (flags & CBLOOM_BLOCKED) {
+        cb->ncounters = ALIGN(cb->ncounters, CBLOOM_BLOCK_COUNTERS);
+        size = cb->ncounters / 2;
+        if (posix_memalign((void **)&cb->counters, CBLOOM_BLOCK_SIZE, size))
+            return -1;
+        memset(cb->counters, 0, size);
+    } else {
+        cb->ncounters = ALIGN(cb->ncounters, 2);
+        cb->counters = calloc(cb->ncounters / 2, 1);
+        if (!cb->counters)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Destroy counting bloom filter.
+ *
+ * @param cb counting bloom filter
+ */
+void cbloom_destroy(struct cbloom *cb) {
+    if (cb && cb->counters) {
+        free(cb->counters);
+        cb->counters = NULL;
+    }
+}
+
+/**
+ * Remove all elements from counting bloom filter.
+ *
+ * @param cb counting bloom filter
+ */
+void cbloom_clear(struct cbloom *cb) {
+    memset(cb->counters, 0, cb->ncounters / 2);
+    cb->count = 0;
+}
+
+/**
+ * Returns the fraction of non-zero counters in counting bloom filter.
+ *
+ * @param cb counting bloom filter
+ */
+double cbloom_fill_ratio(const struct cbloom *cb) {
+    size_t set = 0;
+
+    for (size_t i = 0; i < cb->ncounters; ++i)
+        set += cbloom_get(cb, i) != 0;
+
+    return (double)set / cb->ncounters;
+}
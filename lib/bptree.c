@@ -0,0 +1,589 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bptree.h"
+#include "kernel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** Minimum number of keys of an inner node other than the root */
+#define BPTREE_INNER_MIN (BPTREE_INNER_KEYS / 2)
+/** Minimum number of entries of a leaf other than the root */
+#define BPTREE_LEAF_MIN (BPTREE_LEAF_KEYS / 2)
+
+#define bptree_inner(node) container_of(node, struct bptree_inner, hdr)
+#define bptree_leaf(node) container_of(node, struct bptree_leaf, hdr)
+
+/**
+ * Number of keys below key.
+ *
+ * Counting instead of searching keeps the loop free of unpredictable
+ * branches, nodes are small enough for this to beat a binary search.
+ *
+ * @param keys sorted keys
+ * @param n number of keys
+ * @param key the key
+ */
+static inline unsigned bptree_lower(const uint64_t *keys, unsigned n, uint64_t key) {
+    unsigned i = 0;
+
+    for (unsigned j = 0; j < n; ++j)
+        i += keys[j] < key;
+    return i;
+}
+
+/**
+ * Number of keys not above key, which is the child of an inner node to
+ * descend into.
+ *
+ * @param keys sorted keys
+ * @param n number of keys
+ * @param key the key
+ */
+static inline unsigned bptree_upper(const uint64_t *keys, unsigned n, uint64_t key) {
+    unsigned i = 0;
+
+    for (unsigned j = 0; j < n; ++j)
+        i += keys[j] <= key;
+    return i;
+}
+
+static struct bptree_node *bptree_alloc(void) {
+    struct bptree_node *node;
+
+    if (posix_memalign((void **)&node, BPTREE_NODE_ALIGN, BPTREE_NODE_SIZE))
+        return NULL;
+    return node;
+}
+
+/**
+ * Initialize new tree.
+ *
+ * @param tree B+tree
+ */
+void bptree_init(struct bptree *tree) {
+    *tree = BPTREE_INIT;
+}
+
+/**
+ * Free a subtree.
+ *
+ * @param node subtree root
+ */
+static void bptree_free(struct bptree_node *node) {
+    if (!node->leaf) {
+        struct bptree_inner *inner = bptree_inner(node);
+        for (unsigned i = 0; i <= inner->hdr.count; ++i)
+            bptree_free(inner->children[i]);
+    }
+    free(node);
+}
+
+/**
+ * Destroy tree, the values are left alone.
+ *
+ * @param tree B+tree
+ */
+void bptree_destroy(struct bptree *tree) {
+    if (tree->root)
+        bptree_free(tree->root);
+    bptree_init(tree);
+}
+
+/**
+ * Find the leaf which holds or would hold a key.
+ *
+ * @param tree non-empty B+tree
+ * @param key the key
+ */
+static struct bptree_leaf *bptree_find_leaf(const struct bptree *tree, uint64_t key) {
+    struct bptree_node *node = tree->root;
+
+    while (!node->leaf) {
+        struct bptree_inner *inner = bptree_inner(node);
+        node = inner->children[bptree_upper(inner->keys, inner->hdr.count, key)];
+    }
+    return bptree_leaf(node);
+}
+
+/**
+ * Looks up the tree for the presence of key.
+ *
+ * @param tree B+tree
+ * @param key the key to look for
+ * @return pointer to the value of key, NULL if not found
+ */
+void **bptree_find(const struct bptree *tree, uint64_t key) {
+    struct bptree_leaf *leaf;
+    unsigned i;
+
+    if (!tree->root)
+        return NULL;
+
+    leaf = bptree_find_leaf(tree, key);
+    i = bptree_lower(leaf->keys, leaf->hdr.count, key);
+    if (i < leaf->hdr.count && leaf->keys[i] == key)
+        return &leaf->vals[i];
+    return NULL;
+}
+
+/**
+ * Insert an entry into a leaf, splitting it if full.
+ *
+ * @param tree B+tree
+ * @param leaf the leaf
+ * @param i position of the entry
+ * @param key the key
+ * @param val the value
+ * @param right new leaf used if the leaf is full, receives the upper half
+ */
+static void bptree_leaf_insert(struct bptree *tree, struct bptree_leaf *leaf, unsigned i,
+        uint64_t key, void *val, struct bptree_leaf *right) {
+    uint64_t keys[BPTREE_LEAF_KEYS + 1];
+    void *vals[BPTREE_LEAF_KEYS + 1];
+    unsigned n = leaf->hdr.count, half;
+
+    if (n < BPTREE_LEAF_KEYS) {
+        memmove(&leaf->keys[i + 1], &leaf->keys[i], (n - i) * sizeof(*keys));
+        memmove(&leaf->vals[i + 1], &leaf->vals[i], (n - i) * sizeof(*vals));
+        leaf->keys[i] = key;
+        leaf->vals[i] = val;
+        leaf->hdr.count++;
+        return;
+    }
+
+    memcpy(keys, leaf->keys, i * sizeof(*keys));
+    memcpy(vals, leaf->vals, i * sizeof(*vals));
+    keys[i] = key;
+    vals[i] = val;
+    memcpy(&keys[i + 1], &leaf->keys[i], (n - i) * sizeof(*keys));
+    memcpy(&vals[i + 1], &leaf->vals[i], (n - i) * sizeof(*vals));
+
+    half = (n + 1) / 2;
+    memcpy(leaf->keys, keys, half * sizeof(*keys));
+    memcpy(leaf->vals, vals, half * sizeof(*vals));
+    leaf->hdr.count = half;
+
+    right->hdr.leaf = 1;
+    right->hdr.count = n + 1 - half;
+    memcpy(right->keys, &keys[half], right->hdr.count * sizeof(*keys));
+    memcpy(right->vals, &vals[half], right->hdr.count * sizeof(*vals));
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        tree->last = right;
+    leaf->next = right;
+}
+
+/**
+ * Insert a key and the child on its right into an inner node, splitting
+ * it if full.
+ *
+ * @param inner the inner node
+ * @param i position of the key
+ * @param key the key
+ * @param child the child
+ * @param right new node used if the node is full, receives the upper half
+ * @return key moved up to the parent if the node was split
+ */
+static uint64_t bptree_inner_insert(struct bptree_inner *inner, unsigned i, uint64_t key,
+        struct bptree_node *child, struct bptree_inner *right) {
+    uint64_t keys[BPTREE_INNER_KEYS + 1];
+    struct bptree_node *children[BPTREE_INNER_KEYS + 2];
+    unsigned n = inner->hdr.count, half;
+
+    if (n < BPTREE_INNER_KEYS) {
+        memmove(&inner->keys[i + 1], &inner->keys[i], (n - i) * sizeof(*keys));
+        memmove(&inner->children[i + 2], &inner->children[i + 1], (n - i) * sizeof(*children));
+        inner->keys[i] = key;
+        inner->children[i + 1] = child;
+        inner->hdr.count++;
+        return 0;
+    }
+
+    memcpy(keys, inner->keys, i * sizeof(*keys));
+    keys[i] = key;
+    memcpy(&keys[i + 1], &inner->keys[i], (n - i) * sizeof(*keys));
+    memcpy(children, inner->children, (i + 1) * sizeof(*children));
+    children[i + 1] = child;
+    memcpy(&children[i + 2], &inner->children[i + 1], (n - i) * sizeof(*children));
+
+    // The middle key separates the halves and moves up
+    half = (n + 1) / 2;
+    memcpy(inner->keys, keys, half * sizeof(*keys));
+    memcpy(inner->children, children, (half + 1) * sizeof(*children));
+    inner->hdr.count = half;
+
+    right->hdr.leaf = 0;
+    right->hdr.count = n - half;
+    memcpy(right->keys, &keys[half + 1], right->hdr.count * sizeof(*keys));
+    memcpy(right->children, &children[half + 1], (right->hdr.count + 1) * sizeof(*children));
+
+    return keys[half];
+}
+
+/**
+ * Add an entry to the tree.
+ *
+ * @param tree B+tree
+ * @param key the key
+ * @param val the value
+ * @return 0 if added, 1 if the key is already present, which is left
+ *   unchanged, -1 if out of memory
+ */
+int bptree_insert(struct bptree *tree, uint64_t key, void *val) {
+    struct bptree_inner *path[BPTREE_MAX_HEIGHT];
+    unsigned idx[BPTREE_MAX_HEIGHT];
+    struct bptree_node *spare[BPTREE_MAX_HEIGHT + 1];
+    struct bptree_node *node = tree->root, *child;
+    struct bptree_leaf *leaf;
+    unsigned depth = 0, need = 0, i;
+    uint64_t sep;
+
+    if (!node) {
+        leaf = (struct bptree_leaf *)bptree_alloc();
+        if (!leaf)
+            return -1;
+        leaf->hdr.leaf = 1;
+        leaf->hdr.count = 1;
+        leaf->prev = leaf->next = NULL;
+        leaf->keys[0] = key;
+        leaf->vals[0] = val;
+        tree->root = &leaf->hdr;
+        tree->first = tree->last = leaf;
+        tree->height = 1;
+        tree->count = 1;
+        return 0;
+    }
+
+    while (!node->leaf) {
+        struct bptree_inner *inner = bptree_inner(node);
+        path[depth] = inner;
+        idx[depth] = bptree_upper(inner->keys, inner->hdr.count, key);
+        node = inner->children[idx[depth++]];
+    }
+    leaf = bptree_leaf(node);
+    i = bptree_lower(leaf->keys, leaf->hdr.count, key);
+    if (i < leaf->hdr.count && leaf->keys[i] == key)
+        return 1;
+
+    // Allocate every node the insertion needs up front, so that running
+    // out of memory leaves the tree untouched
+    if (leaf->hdr.count == BPTREE_LEAF_KEYS) {
+        need = 1;
+        while (need <= depth && path[depth - need]->hdr.count == BPTREE_INNER_KEYS)
+            need++;
+        if (need > depth)
+            need++;
+    }
+    for (unsigned k = 0; k < need; ++k) {
+        if (!(spare[k] = bptree_alloc())) {
+            while (k--)
+                free(spare[k]);
+            return -1;
+        }
+    }
+
+    child = need ? spare[0] : NULL;
+    bptree_leaf_insert(tree, leaf, i, key, val, (struct bptree_leaf *)child);
+    if (child)
+        sep = bptree_leaf(child)->keys[0];
+
+    for (unsigned k = 1; child && depth > 0; ++k) {
+        struct bptree_inner *inner = path[--depth];
+        struct bptree_inner *right = inner->hdr.count == BPTREE_INNER_KEYS ?
+            (struct bptree_inner *)spare[k] : NULL;
+
+        sep = bptree_inner_insert(inner, idx[depth], sep, child, right);
+        child = right ? &right->hdr : NULL;
+    }
+
+    if (child) {
+        // The root was split, grow the tree by a level
+        struct bptree_inner *root = (struct bptree_inner *)spare[need - 1];
+        root->hdr.leaf = 0;
+        root->hdr.count = 1;
+        root->keys[0] = sep;
+        root->children[0] = tree->root;
+        root->children[1] = child;
+        tree->root = &root->hdr;
+        tree->height++;
+    }
+
+    tree->count++;
+    return 0;
+}
+
+/**
+ * Fix a leaf with too few entries by taking one from a sibling, or
+ * merging it with one.
+ *
+ * @param tree B+tree
+ * @param parent parent of the leaf
+ * @param i index of the leaf in the parent
+ * @return whether a key was removed from the parent
+ */
+static bool bptree_leaf_rebalance(struct bptree *tree, struct bptree_inner *parent, unsigned i) {
+    struct bptree_leaf *leaf = bptree_leaf(parent->children[i]);
+    struct bptree_leaf *left = i > 0 ? bptree_leaf(parent->children[i - 1]) : NULL;
+    struct bptree_leaf *right = i < parent->hdr.count ? bptree_leaf(parent->children[i + 1]) : NULL;
+
+    if (left && left->hdr.count > BPTREE_LEAF_MIN) {
+        unsigned n = leaf->hdr.count;
+        memmove(&leaf->keys[1], leaf->keys, n * sizeof(*leaf->keys));
+        memmove(&leaf->vals[1], leaf->vals, n * sizeof(*leaf->vals));
+        left->hdr.count--;
+        leaf->keys[0] = left->keys[left->hdr.count];
+        leaf->vals[0] = left->vals[left->hdr.count];
+        leaf->hdr.count++;
+        parent->keys[i - 1] = leaf->keys[0];
+        return false;
+    }
+
+    if (right && right->hdr.count > BPTREE_LEAF_MIN) {
+        leaf->keys[leaf->hdr.count] = right->keys[0];
+        leaf->vals[leaf->hdr.count] = right->vals[0];
+        leaf->hdr.count++;
+        right->hdr.count--;
+        memmove(right->keys, &right->keys[1], right->hdr.count * sizeof(*right->keys));
+        memmove(right->vals, &right->vals[1], right->hdr.count * sizeof(*right->vals));
+        parent->keys[i] = right->keys[0];
+        return false;
+    }
+
+    // Merge into the left one of the pair, the right one goes away
+    if (left) {
+        right = leaf;
+        i--;
+    } else {
+        left = leaf;
+    }
+    memcpy(&left->keys[left->hdr.count], right->keys, right->hdr.count * sizeof(*right->keys));
+    memcpy(&left->vals[left->hdr.count], right->vals, right->hdr.count * sizeof(*right->vals));
+    left->hdr.count += right->hdr.count;
+    left->next = right->next;
+    if (right->next)
+        right->next->prev = left;
+    else
+        tree->last = left;
+    free(right);
+
+    parent->hdr.count--;
+    memmove(&parent->keys[i], &parent->keys[i + 1], (parent->hdr.count - i) * sizeof(*parent->keys));
+    memmove(&parent->children[i + 1], &parent->children[i + 2],
+            (parent->hdr.count - i) * sizeof(*parent->children));
+    return true;
+}
+
+/**
+ * Fix an inner node with too few keys by rotating one through the parent
+ * from a sibling, or merging it with one.
+ *
+ * @param parent parent of the node
+ * @param i index of the node in the parent
+ * @return whether a key was removed from the parent
+ */
+static bool bptree_inner_rebalance(struct bptree_inner *parent, unsigned i) {
+    struct bptree_inner *node = bptree_inner(parent->children[i]);
+    struct bptree_inner *left = i > 0 ? bptree_inner(parent->children[i - 1]) : NULL;
+    struct bptree_inner *right = i < parent->hdr.count ? bptree_inner(parent->children[i + 1]) : NULL;
+
+    if (left && left->hdr.count > BPTREE_INNER_MIN) {
+        unsigned n = node->hdr.count;
+        memmove(&node->keys[1], node->keys, n * sizeof(*node->keys));
+        memmove(&node->children[1], node->children, (n + 1) * sizeof(*node->children));
+        node->keys[0] = parent->keys[i - 1];
+        node->children[0] = left->children[left->hdr.count];
+        node->hdr.count++;
+        parent->keys[i - 1] = left->keys[--left->hdr.count];
+        return false;
+    }
+
+    if (right && right->hdr.count > BPTREE_INNER_MIN) {
+        node->keys[node->hdr.count] = parent->keys[i];
+        node->children[++node->hdr.count] = right->children[0];
+        parent->keys[i] = right->keys[0];
+        right->hdr.count--;
+        memmove(right->keys, &right->keys[1], right->hdr.count * sizeof(*right->keys));
+        memmove(right->children, &right->children[1], (right->hdr.count + 1) * sizeof(*right->children));
+        return false;
+    }
+
+    if (left) {
+        right = node;
+        i--;
+    } else {
+        left = node;
+    }
+    // The separator comes down between the keys of the merged nodes
+    left->keys[left->hdr.count] = parent->keys[i];
+    memcpy(&left->keys[left->hdr.count + 1], right->keys, right->hdr.count * sizeof(*right->keys));
+    memcpy(&left->children[left->hdr.count + 1], right->children,
+            (right->hdr.count + 1) * sizeof(*right->children));
+    left->hdr.count += right->hdr.count + 1;
+    free(right);
+
+    parent->hdr.count--;
+    memmove(&parent->keys[i], &parent->keys[i + 1], (parent->hdr.count - i) * sizeof(*parent->keys));
+    memmove(&parent->children[i + 1], &parent->children[i + 2],
+            (parent->hdr.count - i) * sizeof(*parent->children));
+    return true;
+}
+
+/**
+ * Remove the entry with given key from the tree.
+ *
+ * @param tree B+tree
+ * @param key the key
+ * @param val if not NULL, receives the value of the removed entry
+ * @return 0 on success, -1 if the key was not found
+ */
+int bptree_delete(struct bptree *tree, uint64_t key, void **val) {
+    struct bptree_inner *path[BPTREE_MAX_HEIGHT];
+    unsigned idx[BPTREE_MAX_HEIGHT];
+    struct bptree_node *node = tree->root;
+    struct bptree_leaf *leaf;
+    unsigned depth = 0, i;
+
+    if (!node)
+        return -1;
+
+    while (!node->leaf) {
+        struct bptree_inner *inner = bptree_inner(node);
+        path[depth] = inner;
+        idx[depth] = bptree_upper(inner->keys, inner->hdr.count, key);
+        node = inner->children[idx[depth++]];
+    }
+    leaf = bptree_leaf(node);
+    i = bptree_lower(leaf->keys, leaf->hdr.count, key);
+    if (i >= leaf->hdr.count || leaf->keys[i] != key)
+        return -1;
+
+    if (val)
+        *val = leaf->vals[i];
+    leaf->hdr.count--;
+    memmove(&leaf->keys[i], &leaf->keys[i + 1], (leaf->hdr.count - i) * sizeof(*leaf->keys));
+    memmove(&leaf->vals[i], &leaf->vals[i + 1], (leaf->hdr.count - i) * sizeof(*leaf->vals));
+    tree->count--;
+
+    if (depth == 0) {
+        if (leaf->hdr.count == 0) {
+            free(leaf);
+            bptree_init(tree);
+        }
+        return 0;
+    }
+
+    // Walk up while merges leave parents with too few keys
+    if (leaf->hdr.count < BPTREE_LEAF_MIN) {
+        bool merged = bptree_leaf_rebalance(tree, path[depth - 1], idx[depth - 1]);
+        while (merged && --depth > 0 && path[depth]->hdr.count < BPTREE_INNER_MIN)
+            merged = bptree_inner_rebalance(path[depth - 1], idx[depth - 1]);
+    }
+
+    if (tree->root->count == 0 && !tree->root->leaf) {
+        // The root is left with a single child, which becomes the root
+        struct bptree_inner *root = bptree_inner(tree->root);
+        tree->root = root->children[0];
+        tree->height--;
+        free(root);
+    }
+
+    return 0;
+}
+
+/**
+ * Move the cursor to the first entry of the tree.
+ *
+ * @param tree B+tree
+ * @param cur the cursor
+ * @return whether the tree has an entry
+ */
+bool bptree_first(const struct bptree *tree, struct bptree_cursor *cur) {
+    cur->leaf = tree->first;
+    cur->pos = 0;
+    return cur->leaf != NULL;
+}
+
+/**
+ * Move the cursor to the last entry of the tree.
+ *
+ * @param tree B+tree
+ * @param cur the cursor
+ * @return whether the tree has an entry
+ */
+bool bptree_last(const struct bptree *tree, struct bptree_cursor *cur) {
+    cur->leaf = tree->last;
+    cur->pos = cur->leaf ? cur->leaf->hdr.count - 1 : 0;
+    return cur->leaf != NULL;
+}
+
+/**
+ * Move the cursor to the first entry whose key is not below key.
+ *
+ * @param tree B+tree
+ * @param key the key
+ * @param cur the cursor
+ * @return whether there is such an entry
+ */
+bool bptree_seek(const struct bptree *tree, uint64_t key, struct bptree_cursor *cur) {
+    if (!tree->root) {
+        cur->leaf = NULL;
+        return false;
+    }
+
+    cur->leaf = bptree_find_leaf(tree, key);
+    cur->pos = bptree_lower(cur->leaf->keys, cur->leaf->hdr.count, key);
+    if (cur->pos == cur->leaf->hdr.count) {
+        // All keys of the leaf are lower, the next leaf starts above key
+        cur->leaf = cur->leaf->next;
+        cur->pos = 0;
+    }
+    return cur->leaf != NULL;
+}
+
+/**
+ * Move the cursor to the next entry.
+ *
+ * @param cur valid cursor
+ * @return whether there is a next entry, the cursor is invalid otherwise
+ */
+bool bptree_next(struct bptree_cursor *cur) {
+    if (++cur->pos == cur->leaf->hdr.count) {
+        cur->leaf = cur->leaf->next;
+        cur->pos = 0;
+    }
+    return cur->leaf != NULL;
+}
+
+/**
+ * Move the cursor to the previous entry.
+ *
+ * @param cur valid cursor
+ * @return whether there is a previous entry, the cursor is invalid otherwise
+ */
+bool bptree_prev(struct bptree_cursor *cur) {
+    if (cur->pos-- == 0) {
+        cur->leaf = cur->leaf->prev;
+        cur->pos = cur->leaf ? cur->leaf->hdr.count - 1 : 0;
+    }
+    return cur->leaf != NULL;
+}
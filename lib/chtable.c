@@ -0,0 +1,435 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chtable.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+/** Reader slot of the calling thread, assigned on first use */
+static __thread unsigned reader_slot = -1U;
+static atomic_uint reader_slots = ATOMIC_VAR_INIT(0);
+
+/**
+ * Allocate empty bucket array.
+ *
+ * @param size number of buckets
+ */
+static struct chtable_buckets *chtable_alloc_buckets(size_t size) {
+    struct chtable_buckets *bucks;
+
+    bucks = malloc(sizeof(*bucks) + sizeof(struct hlist_head) * size);
+    if (!bucks)
+        return NULL;
+
+    bucks->size = size;
+    atomic_init(&bucks->rehash_idx, 0);
+    atomic_init(&bucks->rehash_done, 0);
+    for (size_t i = 0; i < size; ++i)
+        INIT_HLIST_HEAD(&bucks->heads[i]);
+
+    return bucks;
+}
+
+/**
+ * Initialize new table of given size.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to a power of two
+ * @return 0 on success, -1 otherwise
+ */
+int chtable_init_n(struct chtable *table, size_t n) {
+    if (!table)
+        return -1;
+
+    n = max_t(size_t, n, CHTABLE_LOCK_STRIPES);
+    table->bucks = chtable_alloc_buckets(roundup_pow_of_two(n));
+    if (!table->bucks)
+        return -1;
+    table->old_bucks = NULL;
+    atomic_init(&table->retired, 0);
+
+    atomic_init(&table->epoch, 0);
+    pthread_mutex_init(&table->resize_lock, NULL);
+    pthread_mutex_init(&table->sync_lock, NULL);
+    for (int i = 0; i < CHTABLE_LOCK_STRIPES; ++i) {
+        pthread_mutex_init(&table->stripes[i].lock, NULL);
+        atomic_init(&table->stripes[i].seq, 0);
+        table->stripes[i].count = 0;
+    }
+    for (int i = 0; i < CHTABLE_READER_SLOTS; ++i) {
+        atomic_init(&table->readers[i].count[0], 0);
+        atomic_init(&table->readers[i].count[1], 0);
+    }
+
+    return 0;
+}
+
+/**
+ * Initialize new hash table.
+ *
+ * @param table hash table
+ * @return 0 on success, -1 otherwise
+ */
+int chtable_init(struct chtable *table) {
+    return chtable_init_n(table, CHTABLE_LOCK_STRIPES);
+}
+
+/**
+ * Free a list of retired bucket arrays.
+ *
+ * @param bucks first array of the list
+ */
+static void chtable_free_retired(struct chtable_buckets *bucks) {
+    struct chtable_buckets *next;
+
+    for (; bucks; bucks = next) {
+        next = bucks->retired_next;
+        free(bucks);
+    }
+}
+
+/**
+ * Destroy hash table.
+ *
+ * There must be no concurrent readers nor writers.
+ *
+ * @param table hash table
+ */
+void chtable_destroy(struct chtable *table) {
+    if (!table)
+        return;
+
+    free(table->bucks);
+    free(table->old_bucks);
+    chtable_free_retired((struct chtable_buckets *)atomic_load(&table->retired));
+    pthread_mutex_destroy(&table->resize_lock);
+    pthread_mutex_destroy(&table->sync_lock);
+    for (int i = 0; i < CHTABLE_LOCK_STRIPES; ++i)
+        pthread_mutex_destroy(&table->stripes[i].lock);
+}
+
+/**
+ * Enter read-side critical section.
+ *
+ * @param table hash table
+ * @return token to be passed to chtable_read_unlock()
+ */
+unsigned chtable_read_lock(struct chtable *table) {
+    unsigned idx;
+
+    if (reader_slot == -1U)
+        reader_slot = atomic_fetch_add(&reader_slots, 1) % CHTABLE_READER_SLOTS;
+
+    idx = atomic_load_explicit(&table->epoch, memory_order_relaxed) & 1;
+    atomic_fetch_add_explicit(&table->readers[reader_slot].count[idx], 1, memory_order_relaxed);
+    // Pairs with the fence in chtable_synchronize()
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return reader_slot << 1 | idx;
+}
+
+/**
+ * Leave read-side critical section.
+ *
+ * @param table hash table
+ * @param token token returned by chtable_read_lock()
+ */
+void chtable_read_unlock(struct chtable *table, unsigned token) {
+    atomic_fetch_sub_explicit(&table->readers[token >> 1].count[token & 1], 1, memory_order_release);
+}
+
+/**
+ * Wait until all read-side critical sections in progress have finished.
+ *
+ * Entries removed before the call can be freed once it returns. Bucket
+ * arrays retired by resizes completed before the call are freed. Must not
+ * be called from within a read-side critical section.
+ *
+ * @param table hash table
+ */
+void chtable_synchronize(struct chtable *table) {
+    struct chtable_buckets *retired;
+    unsigned idx;
+
+    pthread_mutex_lock(&table->sync_lock);
+    retired = (struct chtable_buckets *)atomic_exchange(&table->retired, 0);
+
+    /*
+     * A reader may load the epoch, stall and only count itself in its
+     * phase once that phase was drained. It then sees every update made
+     * before the drain, but it stays in the old phase, which would go
+     * unchecked by the next grace period if each one only drained the
+     * phase flipped away from. Draining both phases in turn waits for it.
+     */
+    for (int flip = 0; flip < 2; ++flip) {
+        // Pairs with the fence in chtable_read_lock()
+        atomic_thread_fence(memory_order_seq_cst);
+        idx = atomic_fetch_add(&table->epoch, 1) & 1;
+
+        for (int i = 0; i < CHTABLE_READER_SLOTS; ++i) {
+            while (atomic_load_explicit(&table->readers[i].count[idx], memory_order_acquire))
+                sched_yield();
+        }
+    }
+
+    pthread_mutex_unlock(&table->sync_lock);
+    chtable_free_retired(retired);
+}
+
+static inline void chtable_write_seqbegin(struct chtable_stripe *stripe) {
+    unsigned seq = atomic_load_explicit(&stripe->seq, memory_order_relaxed);
+    atomic_store_explicit(&stripe->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void chtable_write_seqend(struct chtable_stripe *stripe) {
+    unsigned seq = atomic_load_explicit(&stripe->seq, memory_order_relaxed);
+    atomic_store_explicit(&stripe->seq, seq + 1, memory_order_release);
+}
+
+static void chtable_lock_all(struct chtable *table) {
+    for (int i = 0; i < CHTABLE_LOCK_STRIPES; ++i) {
+        pthread_mutex_lock(&table->stripes[i].lock);
+        chtable_write_seqbegin(&table->stripes[i]);
+    }
+}
+
+static void chtable_unlock_all(struct chtable *table) {
+    for (int i = CHTABLE_LOCK_STRIPES - 1; i >= 0; --i) {
+        chtable_write_seqend(&table->stripes[i]);
+        pthread_mutex_unlock(&table->stripes[i].lock);
+    }
+}
+
+/**
+ * Start migrating the table into a bucket array of the given size.
+ *
+ * Entries are moved by subsequent add and delete operations.
+ *
+ * @param table hash table
+ * @param size new number of buckets, must be a power of two
+ * @return 0 on success, -1 when a resize is in progress or on failure
+ */
+int chtable_resize(struct chtable *table, size_t size) {
+    struct chtable_buckets *bucks;
+    int ret = -1;
+
+    if (size < CHTABLE_LOCK_STRIPES)
+        return -1;
+
+    pthread_mutex_lock(&table->resize_lock);
+    if (table->old_bucks || table->bucks->size == size)
+        goto out;
+    if (!(bucks = chtable_alloc_buckets(size)))
+        goto out;
+
+    chtable_lock_all(table);
+    rcu_assign_pointer(table->old_bucks, table->bucks);
+    rcu_assign_pointer(table->bucks, bucks);
+    chtable_unlock_all(table);
+    ret = 0;
+
+out:
+    pthread_mutex_unlock(&table->resize_lock);
+    return ret;
+}
+
+/**
+ * Move all entries of an old bucket into the new bucket array.
+ *
+ * @param table hash table
+ * @param old bucket array being migrated
+ * @param i index of the bucket
+ */
+static void chtable_migrate_bucket(struct chtable *table, struct chtable_buckets *old, size_t i) {
+    struct chtable_stripe *stripe = &table->stripes[i & (CHTABLE_LOCK_STRIPES - 1)];
+    struct hlist_node *pos, *next;
+
+    pthread_mutex_lock(&stripe->lock);
+    if (!hlist_empty(&old->heads[i])) {
+        struct chtable_buckets *bucks = table->bucks;
+
+        chtable_write_seqbegin(stripe);
+        hlist_for_each_safe(pos, next, &old->heads[i]) {
+            struct htable_entry *e = hlist_entry(pos, struct htable_entry, node);
+            hlist_del_rcu(pos);
+            hlist_add_head_rcu(pos, &bucks->heads[chtable_which_bucket(bucks, e->hash)]);
+        }
+        chtable_write_seqend(stripe);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/**
+ * Help migrating old buckets if a resize is in progress.
+ *
+ * The writer which migrates the last bucket unpublishes the old array and
+ * leaves it to the next grace period, since the writer may itself be within
+ * a read-side critical section.
+ *
+ * @param table hash table
+ */
+static void chtable_rehash_step(struct chtable *table) {
+    struct chtable_buckets *old;
+    size_t done = 0, finished = 0;
+    uintptr_t head;
+    unsigned token;
+
+    if (!rcu_dereference(table->old_bucks))
+        return;
+
+    // Keeps the old array alive while looking at it
+    token = chtable_read_lock(table);
+    if ((old = rcu_dereference(table->old_bucks))) {
+        for (int n = 0; n < CHTABLE_REHASH_STEP; ++n) {
+            size_t i = atomic_fetch_add(&old->rehash_idx, 1);
+            if (i >= old->size)
+                break;
+            chtable_migrate_bucket(table, old, i);
+            done++;
+        }
+        if (done)
+            finished = atomic_fetch_add(&old->rehash_done, done) + done == old->size;
+    }
+    chtable_read_unlock(table, token);
+
+    if (finished) {
+        chtable_lock_all(table);
+        rcu_assign_pointer(table->old_bucks, NULL);
+        chtable_unlock_all(table);
+
+        head = atomic_load_explicit(&table->retired, memory_order_relaxed);
+        do {
+            old->retired_next = (struct chtable_buckets *)head;
+        } while (!atomic_compare_exchange_weak(&table->retired, &head, (uintptr_t)old));
+    }
+}
+
+/**
+ * Add a new entry into hash table.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ */
+void chtable_add(struct chtable *table, struct htable_entry *entry, void *key, size_t len) {
+    unsigned hash = jhash(key, len, 0);
+    struct chtable_stripe *stripe = &table->stripes[chtable_which_stripe(hash)];
+    struct chtable_buckets *bucks;
+    size_t count, size;
+
+    INIT_HTABLE_ENTRY(entry, key, len);
+    entry->hash = hash;
+
+    pthread_mutex_lock(&stripe->lock);
+    bucks = table->bucks;
+    hlist_add_head_rcu(&entry->node, &bucks->heads[chtable_which_bucket(bucks, hash)]);
+    count = ++stripe->count;
+    size = bucks->size;
+    pthread_mutex_unlock(&stripe->lock);
+
+    // Each stripe covers an equal share of buckets
+    if (count > size / CHTABLE_LOCK_STRIPES * CHTABLE_GROW_LOAD && !rcu_dereference(table->old_bucks))
+        chtable_resize(table, size << 1);
+
+    chtable_rehash_step(table);
+}
+
+/**
+ * Remove entry from its bucket with the stripe lock held.
+ */
+static struct htable_entry *__chtable_del(struct chtable *table, struct chtable_stripe *stripe,
+        const void *key, size_t len, unsigned hash, struct htable_entry *entry) {
+    struct chtable_buckets *arrays[2] = { table->bucks, table->old_bucks };
+    struct hlist_node *n;
+    struct htable_entry *e;
+
+    for (int i = 0; i < 2 && arrays[i]; ++i) {
+        hlist_for_each_entry(e, n, &arrays[i]->heads[chtable_which_bucket(arrays[i], hash)], node) {
+            if (entry ? e == entry : htable_entry_match(e, hash, key, len)) {
+                hlist_del_rcu(&e->node);
+                stripe->count--;
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remove entry with the given key from hash table.
+ *
+ * The entry must not be freed before chtable_synchronize() returns.
+ *
+ * @param table the hash table to remove entry from
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if the key was not found
+ */
+struct htable_entry *chtable_del_key(struct chtable *table, const void *key, size_t len) {
+    unsigned hash = jhash(key, len, 0);
+    struct chtable_stripe *stripe = &table->stripes[chtable_which_stripe(hash)];
+    struct htable_entry *e;
+
+    pthread_mutex_lock(&stripe->lock);
+    e = __chtable_del(table, stripe, key, len, hash, NULL);
+    pthread_mutex_unlock(&stripe->lock);
+
+    chtable_rehash_step(table);
+    return e;
+}
+
+/**
+ * Remove entry previously added to the hash table.
+ *
+ * The entry must not be freed before chtable_synchronize() returns.
+ *
+ * @param table the hash table to remove entry from
+ * @param entry the hash entry
+ * @return the removed entry, NULL if it was not in the table
+ */
+struct htable_entry *chtable_del_entry(struct chtable *table, struct htable_entry *entry) {
+    struct chtable_stripe *stripe = &table->stripes[chtable_which_stripe(entry->hash)];
+    struct htable_entry *e;
+
+    pthread_mutex_lock(&stripe->lock);
+    e = __chtable_del(table, stripe, entry->key, entry->len, entry->hash, entry);
+    pthread_mutex_unlock(&stripe->lock);
+
+    chtable_rehash_step(table);
+    return e;
+}
+
+/**
+ * Returns the number of entries in the table.
+ *
+ * The result is only a snapshot when there are concurrent writers.
+ *
+ * @param table hash table
+ */
+size_t chtable_count(struct chtable *table) {
+    size_t count = 0;
+
+    for (int i = 0; i < CHTABLE_LOCK_STRIPES; ++i) {
+        pthread_mutex_lock(&table->stripes[i].lock);
+        count += table->stripes[i].count;
+        pthread_mutex_unlock(&table->stripes[i].lock);
+    }
+    return count;
+}
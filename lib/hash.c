@@ -0,0 +1,420 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hash.h"
+#include "kernel.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HASH_CRC32C_SSE42 1
+#endif
+
+/* Secrets of the 64-bit hash, odd and with balanced bits */
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+#define HASH_P3 0x589965cc75374cc1ULL
+
+/** Castagnoli polynomial, bit reflected */
+#define CRC32C_POLY 0x82f63b78
+
+static inline uint64_t hash_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t hash_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/**
+ * Multiply two 64-bit values into a 128-bit product.
+ *
+ * @param a set to the low half of the product
+ * @param b set to the high half of the product
+ */
+static inline void hash_mul128(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t t = ll + (hl << 32), lo = t + (lh << 32);
+    uint64_t carry = (t < ll) + (lo < t);
+    *a = lo;
+    *b = hh + (hl >> 32) + (lh >> 32) + carry;
+#endif
+}
+
+/** Multiply and fold the 128-bit product into 64 bits */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    hash_mul128(&a, &b);
+    return a ^ b;
+}
+
+/** Spread the seed, so that similar seeds give unrelated hashes */
+static inline uint64_t hash_seed(uint64_t seed) {
+    return seed ^ hash_mix(seed ^ HASH_P0, HASH_P1);
+}
+
+/** Read a key of up to 16 bytes as two words */
+static inline void hash_small(const uint8_t *p, size_t len, uint64_t *a, uint64_t *b) {
+    if (len >= 4) {
+        size_t mid = (len >> 3) << 2;
+        *a = hash_read32(p) << 32 | hash_read32(p + mid);
+        *b = hash_read32(p + len - 4) << 32 | hash_read32(p + len - 4 - mid);
+    } else if (len > 0) {
+        *a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+        *b = 0;
+    } else {
+        *a = *b = 0;
+    }
+}
+
+/** Consume 48 bytes in three independent multiply chains */
+static inline void hash_round48(uint64_t *seed, uint64_t *s1, uint64_t *s2, const uint8_t *p) {
+    *seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ *seed);
+    *s1 = hash_mix(hash_read64(p + 16) ^ HASH_P2, hash_read64(p + 24) ^ *s1);
+    *s2 = hash_mix(hash_read64(p + 32) ^ HASH_P3, hash_read64(p + 40) ^ *s2);
+}
+
+/** Consume 16 bytes */
+static inline uint64_t hash_round16(uint64_t seed, const uint8_t *p) {
+    return hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+}
+
+/** Mix the last two words and the length into the hash */
+static inline uint64_t hash_finish(uint64_t seed, uint64_t a, uint64_t b, size_t len) {
+    a ^= HASH_P1;
+    b ^= seed;
+    hash_mul128(&a, &b);
+    return hash_mix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+}
+
+/**
+ * Hash a byte string into 64 bits.
+ *
+ * Keys of up to 16 bytes are read as at most four overlapping loads, so
+ * short keys hash without any loop. Longer keys are consumed 48 bytes at
+ * a time by three independent multiply chains, which keeps the hash close
+ * to memory bandwidth on large keys. The result does not depend on the
+ * byte order of the machine.
+ *
+ * @param seed arbitrary value selecting the hash function
+ * @param data sequence of bytes as key
+ * @param len the length of the key
+ * @return the hash value of the key
+ */
+uint64_t hash_bytes(uint64_t seed, const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t a, b;
+
+    seed = hash_seed(seed);
+
+    if (len <= 16) {
+        hash_small(p, len, &a, &b);
+    } else {
+        size_t i = len;
+
+        if (i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                hash_round48(&seed, &s1, &s2, p);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = hash_round16(seed, p);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, overlapping bytes already consumed
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    }
+
+    return hash_finish(seed, a, b, len);
+}
+
+/**
+ * Start hashing a key made of several fragments with hash_bytes().
+ *
+ * The total length decides how the key is split into rounds, it must
+ * thus be known upfront.
+ *
+ * @param state hash state
+ * @param seed arbitrary value selecting the hash function
+ * @param len the total length of the key
+ */
+void hash_bytes_init(struct hash_state *state, uint64_t seed, size_t len) {
+    size_t rest;
+
+    state->seed = state->s1 = state->s2 = hash_seed(seed);
+    state->len = len;
+    state->done = 0;
+    state->buflen = 0;
+    memset(state->last, 0, sizeof(state->last));
+
+    // Same round schedule as the one-shot version
+    state->end48 = len > 48 ? (len - 1) / 48 * 48 : 0;
+    rest = len - state->end48;
+    state->end = state->end48 + (len > 16 && rest > 16 ? (rest - 1) / 16 * 16 : 0);
+}
+
+/** Consume a round of the size returned by hash_state_round() */
+static void hash_state_consume(struct hash_state *state, const uint8_t *p, size_t round) {
+    if (round == 48) {
+        hash_round48(&state->seed, &state->s1, &state->s2, p);
+        state->done += 48;
+        if (state->done == state->end48)
+            state->seed ^= state->s1 ^ state->s2;
+    } else {
+        state->seed = hash_round16(state->seed, p);
+        state->done += 16;
+    }
+}
+
+/** Size of the next round, 0 once only the final step is left */
+static inline size_t hash_state_round(const struct hash_state *state) {
+    if (state->done < state->end48)
+        return 48;
+    if (state->done < state->end)
+        return 16;
+    return 0;
+}
+
+/**
+ * Hash the next fragment of a key.
+ *
+ * @param state hash state
+ * @param data the fragment
+ * @param len the length of the fragment
+ */
+void hash_bytes_update(struct hash_state *state, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t round, n;
+
+    // The final step reads the last 16 bytes of the key
+    if (len >= sizeof(state->last)) {
+        memcpy(state->last, p + len - sizeof(state->last), sizeof(state->last));
+    } else {
+        memmove(state->last, state->last + len, sizeof(state->last) - len);
+        memcpy(state->last + sizeof(state->last) - len, p, len);
+    }
+
+    if (state->len <= 16) {
+        // Short keys are hashed as a whole by the final step
+        n = min_t(size_t, len, sizeof(state->buf) - state->buflen);
+        memcpy(state->buf + state->buflen, p, n);
+        state->buflen += n;
+        return;
+    }
+
+    while (len > 0 && (round = hash_state_round(state))) {
+        if (state->buflen == 0 && len >= round) {
+            hash_state_consume(state, p, round);
+            p += round;
+            len -= round;
+            continue;
+        }
+
+        n = min_t(size_t, len, round - state->buflen);
+        memcpy(state->buf + state->buflen, p, n);
+        state->buflen += n;
+        p += n;
+        len -= n;
+        if (state->buflen == round) {
+            hash_state_consume(state, state->buf, round);
+            state->buflen = 0;
+        }
+    }
+}
+
+/**
+ * Finish hashing a key made of several fragments.
+ *
+ * All the bytes announced to hash_bytes_init() must have been passed to
+ * hash_bytes_update(), the result is then the same as hash_bytes() on the
+ * concatenated fragments.
+ *
+ * @param state hash state
+ * @return the hash value of the key
+ */
+uint64_t hash_bytes_final(struct hash_state *state) {
+    uint64_t a, b;
+
+    if (state->len <= 16) {
+        hash_small(state->buf, state->len, &a, &b);
+    } else {
+        a = hash_read64(state->last);
+        b = hash_read64(state->last + 8);
+    }
+
+    return hash_finish(state->seed, a, b, state->len);
+}
+
+/**
+ * Hash a key scattered across several buffers with hash_bytes().
+ *
+ * @param seed arbitrary value selecting the hash function
+ * @param iov the buffers
+ * @param iovcnt the number of buffers
+ * @return the same value as hash_bytes() on the concatenated buffers
+ */
+uint64_t hash_bytes_iov(uint64_t seed, const struct iovec *iov, int iovcnt) {
+    struct hash_state state;
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+
+    hash_bytes_init(&state, seed, len);
+    for (int i = 0; i < iovcnt; ++i)
+        hash_bytes_update(&state, iov[i].iov_base, iov[i].iov_len);
+
+    return hash_bytes_final(&state);
+}
+
+/**
+ * Compute the CRC32C checksum of a key scattered across several buffers.
+ *
+ * @param crc checksum of the preceding data, or 0
+ * @param iov the buffers
+ * @param iovcnt the number of buffers
+ * @return the same value as hash_crc32c() on the concatenated buffers
+ */
+uint32_t hash_crc32c_iov(uint32_t crc, const struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; ++i)
+        crc = hash_crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+
+    return crc;
+}
+
+/** Slicing-by-8 tables, built on first use without hardware support */
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j)
+            crc = crc >> 1 ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t)
+            crc32c_table[t][i] = crc32c_table[t - 1][i] >> 8 ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+    }
+}
+
+/**
+ * Compute CRC32C eight bytes at a time with table lookups.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][lo >> 8 & 0xff] ^
+              crc32c_table[5][lo >> 16 & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^ crc32c_table[2][hi >> 8 & 0xff] ^
+              crc32c_table[1][hi >> 16 & 0xff] ^ crc32c_table[0][hi >> 24];
+    }
+    while (len--)
+        crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#ifdef HASH_CRC32C_SSE42
+/**
+ * Compute CRC32C with the SSE4.2 crc32 instruction.
+ */
+static __attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; len >= 4; len -= 4, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+    }
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const uint8_t *, size_t);
+
+/**
+ * Pick the hardware implementation when the processor supports it.
+ */
+static void crc32c_resolve(void) {
+    uint32_t (*impl)(uint32_t, const uint8_t *, size_t) = crc32c_sw;
+
+#ifdef HASH_CRC32C_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        impl = crc32c_sse42;
+#endif
+    if (impl == crc32c_sw)
+        crc32c_init_table();
+
+    // Publishes the tables, concurrent callers build identical ones
+    __atomic_store_n(&crc32c_impl, impl, __ATOMIC_RELEASE);
+}
+
+/**
+ * Compute the CRC32C (Castagnoli) checksum of a byte string.
+ *
+ * The implementation is selected on first use. Checksums of consecutive
+ * chunks are chained by passing the previous result as crc.
+ *
+ * @param crc checksum of the preceding data, or 0
+ * @param data sequence of bytes
+ * @param len the length of the data
+ * @return the checksum, also usable as a 32-bit hash seeded by crc
+ */
+uint32_t hash_crc32c(uint32_t crc, const void *data, size_t len) {
+    uint32_t (*impl)(uint32_t, const uint8_t *, size_t);
+
+    if (!(impl = __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE))) {
+        crc32c_resolve();
+        impl = crc32c_impl;
+    }
+
+    return ~impl(~crc, data, len);
+}
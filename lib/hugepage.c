@@ -0,0 +1,99 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hugepage.h"
+#include "kernel.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+/**
+ * Size of the mapping holding size bytes.
+ *
+ * @param size allocation size
+ */
+static size_t hugepage_map_size(size_t size) {
+    if (size >= HUGE_PAGE_SIZE)
+        return ALIGN(size, HUGE_PAGE_SIZE);
+    return ALIGN(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * Map anonymous memory.
+ *
+ * @param size mapping size
+ * @param flags extra mmap flags
+ * @return start of the mapping or NULL
+ */
+static void *hugepage_map(size_t size, int flags) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * Allocate zeroed memory, backed by huge pages if possible.
+ *
+ * @param size allocation size
+ * @return allocated memory or NULL
+ */
+void *hugepage_alloc(size_t size) {
+    size_t len = hugepage_map_size(size);
+    uint8_t *p;
+
+    if (!size)
+        return NULL;
+    if (size < HUGE_PAGE_SIZE)
+        return hugepage_map(len, 0);
+
+#ifdef MAP_HUGETLB
+    p = hugepage_map(len, MAP_HUGETLB);
+    if (p)
+        return p;
+#endif
+
+    // Over-allocate by a huge page and trim the mapping to an aligned start
+    p = hugepage_map(len + HUGE_PAGE_SIZE, 0);
+    if (!p)
+        return NULL;
+
+    size_t head = ALIGN((uintptr_t)p, HUGE_PAGE_SIZE) - (uintptr_t)p;
+    if (head)
+        munmap(p, head);
+    munmap(p + head + len, HUGE_PAGE_SIZE - head);
+    p += head;
+
+#ifdef MADV_HUGEPAGE
+    // Failure only means normal pages are used
+    madvise(p, len, MADV_HUGEPAGE);
+#endif
+
+    return p;
+}
+
+/**
+ * Free memory allocated by hugepage_alloc().
+ *
+ * @param ptr allocated memory, may be NULL
+ * @param size size passed to hugepage_alloc()
+ */
+void hugepage_free(void *ptr, size_t size) {
+    if (ptr)
+        munmap(ptr, hugepage_map_size(size));
+}
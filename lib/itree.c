@@ -0,0 +1,184 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "itree.h"
+
+#define itree_entry(ptr) rb_entry(ptr, struct itree_node, rb)
+
+/**
+ * Largest last of a subtree, computed from the children.
+ *
+ * @param node subtree root
+ */
+static uint64_t itree_compute_last(const struct itree_node *node) {
+    uint64_t max = node->last;
+
+    if (node->rb.rb_left && itree_entry(node->rb.rb_left)->__subtree_last > max)
+        max = itree_entry(node->rb.rb_left)->__subtree_last;
+    if (node->rb.rb_right && itree_entry(node->rb.rb_right)->__subtree_last > max)
+        max = itree_entry(node->rb.rb_right)->__subtree_last;
+    return max;
+}
+
+/**
+ * Recompute subtree maximums from node up to stop.
+ *
+ * @param rb first node to update
+ * @param stop node where to stop, NULL for the root
+ */
+static void itree_propagate(struct rb_node *rb, struct rb_node *stop) {
+    while (rb != stop) {
+        struct itree_node *node = itree_entry(rb);
+        uint64_t last = itree_compute_last(node);
+
+        if (node->__subtree_last == last)
+            break;
+        node->__subtree_last = last;
+        rb = rb_parent(rb);
+    }
+}
+
+static void itree_copy(struct rb_node *old, struct rb_node *new) {
+    itree_entry(new)->__subtree_last = itree_entry(old)->__subtree_last;
+}
+
+static void itree_rotate(struct rb_node *old, struct rb_node *new) {
+    itree_entry(new)->__subtree_last = itree_entry(old)->__subtree_last;
+    itree_entry(old)->__subtree_last = itree_compute_last(itree_entry(old));
+}
+
+static const struct rb_augment_callbacks itree_augment = {
+    .propagate = itree_propagate,
+    .copy = itree_copy,
+    .rotate = itree_rotate,
+};
+
+/**
+ * Add interval to the tree.
+ *
+ * @param node interval with start and last set, start <= last
+ * @param root tree root
+ */
+void itree_insert(struct itree_node *node, struct rb_root *root) {
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+
+    while (*link) {
+        struct itree_node *p = itree_entry(*link);
+
+        parent = *link;
+        if (p->__subtree_last < node->last)
+            p->__subtree_last = node->last;
+        if (node->start < p->start)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+
+    node->__subtree_last = node->last;
+    rb_link_node(&node->rb, parent, link);
+    rb_insert_augmented(&node->rb, root, &itree_augment);
+}
+
+/**
+ * Remove interval from the tree.
+ *
+ * @param node interval in the tree
+ * @param root tree root
+ */
+void itree_remove(struct itree_node *node, struct rb_root *root) {
+    rb_erase_augmented(&node->rb, root, &itree_augment);
+}
+
+/**
+ * Find the first interval of a subtree overlapping [start, last].
+ *
+ * @param node subtree root, whose subtree ends at or after start
+ * @param start first point of the range
+ * @param last last point of the range
+ */
+static struct itree_node *itree_subtree_search(struct itree_node *node, uint64_t start, uint64_t last) {
+    for (;;) {
+        // Intervals on the left start earlier, look there first
+        if (node->rb.rb_left) {
+            struct itree_node *left = itree_entry(node->rb.rb_left);
+            if (left->__subtree_last >= start) {
+                node = left;
+                continue;
+            }
+        }
+        if (node->start > last)
+            return NULL;
+        if (node->last >= start)
+            return node;
+        if (!node->rb.rb_right)
+            return NULL;
+        node = itree_entry(node->rb.rb_right);
+        if (node->__subtree_last < start)
+            return NULL;
+    }
+}
+
+/**
+ * Find the first interval overlapping [start, last].
+ *
+ * @param root tree root
+ * @param start first point of the range
+ * @param last last point of the range
+ * @return overlapping interval with the lowest start, or NULL
+ */
+struct itree_node *itree_iter_first(const struct rb_root *root, uint64_t start, uint64_t last) {
+    struct itree_node *node;
+
+    if (!root->rb_node)
+        return NULL;
+    node = itree_entry(root->rb_node);
+    if (node->__subtree_last < start)
+        return NULL;
+    return itree_subtree_search(node, start, last);
+}
+
+/**
+ * Find the next interval overlapping [start, last].
+ *
+ * @param node interval returned by the previous query with the same range
+ * @param start first point of the range
+ * @param last last point of the range
+ * @return next overlapping interval, or NULL
+ */
+struct itree_node *itree_iter_next(struct itree_node *node, uint64_t start, uint64_t last) {
+    struct rb_node *rb = node->rb.rb_right, *prev;
+
+    for (;;) {
+        // Look in the right subtree first, then in the next ancestor on the right
+        if (rb && itree_entry(rb)->__subtree_last >= start)
+            return itree_subtree_search(itree_entry(rb), start, last);
+
+        do {
+            rb = rb_parent(&node->rb);
+            if (!rb)
+                return NULL;
+            prev = &node->rb;
+            node = itree_entry(rb);
+            rb = rb->rb_right;
+        } while (prev == rb);
+
+        if (node->start > last)
+            return NULL;
+        if (node->last >= start)
+            return node;
+    }
+}
@@ -0,0 +1,192 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jhash.h"
+
+/**
+ * Hash keys one after the other.
+ */
+static void jhash_bulk_scalar(const void *const *keys, uint32_t length, uint32_t initval,
+        uint32_t *hashes, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        hashes[i] = jhash(keys[i], length, initval);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(JHASH_LITTLE_ENDIAN)
+#define JHASH_SIMD 1
+
+/*
+ * Vector versions hash one key per 32-bit lane. Since all keys have the
+ * same length, every lane goes through the same sequence of mixing steps
+ * and the vector code is the scalar algorithm applied lane-wise.
+ */
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+#define __jhash_vrol(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+#define __jhash_vmix(a, b, c) ({ \
+    a -= c;  a ^= __jhash_vrol(c, 4);  c += b; \
+    b -= a;  b ^= __jhash_vrol(a, 6);  a += c; \
+    c -= b;  c ^= __jhash_vrol(b, 8);  b += a; \
+    a -= c;  a ^= __jhash_vrol(c, 16); c += b; \
+    b -= a;  b ^= __jhash_vrol(a, 19); a += c; \
+    c -= b;  c ^= __jhash_vrol(b, 4);  b += a; })
+
+#define __jhash_vfinal(a, b, c) ({ \
+    c ^= b; c -= __jhash_vrol(b, 14); \
+    a ^= c; a -= __jhash_vrol(c, 11); \
+    b ^= a; b -= __jhash_vrol(a, 25); \
+    c ^= b; c -= __jhash_vrol(b, 16); \
+    a ^= c; a -= __jhash_vrol(c, 4); \
+    b ^= a; b -= __jhash_vrol(a, 14); \
+    c ^= b; c -= __jhash_vrol(b, 24); })
+
+/**
+ * Load the last block of a key as three little-endian words.
+ *
+ * Adds exactly the bytes the scalar version adds in its final switch.
+ *
+ * @param k pointer to the last block
+ * @param len length of the last block, 1 to 12
+ * @param w the three words
+ */
+static inline void __jhash_tail(const uint8_t *k, uint32_t len, uint32_t *w) {
+    w[0] = w[1] = w[2] = 0;
+    switch (len) {
+    case 12: w[2] = __jhash_get_le32(k + 8);
+             w[1] = __jhash_get_le32(k + 4);
+             w[0] = __jhash_get_le32(k);
+             break;
+    case 11: w[2] += (uint32_t)k[10] << 16; // fallthrough
+    case 10: w[2] += (uint32_t)k[9] << 8; // fallthrough
+    case 9:  w[2] += k[8]; // fallthrough
+    case 8:  w[1] = __jhash_get_le32(k + 4);
+             w[0] = __jhash_get_le32(k);
+             break;
+    case 7:  w[1] += (uint32_t)k[6] << 16; // fallthrough
+    case 6:  w[1] += (uint32_t)k[5] << 8; // fallthrough
+    case 5:  w[1] += k[4]; // fallthrough
+    case 4:  w[0] = __jhash_get_le32(k);
+             break;
+    case 3:  w[0] += (uint32_t)k[2] << 16; // fallthrough
+    case 2:  w[0] += (uint32_t)k[1] << 8; // fallthrough
+    case 1:  w[0] += k[0];
+             break;
+    }
+}
+
+/**
+ * Define a function hashing keys in groups of vector width.
+ *
+ * The words of a block are gathered from all keys into arrays which are
+ * then loaded as vectors, the length being equal the tail is handled by
+ * the same case for all keys.
+ *
+ * @param name function name
+ * @param isa instruction set the function is compiled for
+ * @param vtype vector type
+ * @param width number of lanes
+ */
+#define DEFINE_JHASH_BULK(name, isa, vtype, width) \
+static __attribute__((target(isa))) void name(const void *const *keys, uint32_t length, \
+        uint32_t initval, uint32_t *hashes, size_t n) { \
+    size_t i = 0; \
+    \
+    for (; i + (width) <= n; i += (width)) { \
+        const uint8_t *const *k = (const uint8_t *const *)&keys[i]; \
+        uint32_t len = length, off = 0; \
+        vtype a, b, c, wa = { 0 }, wb = { 0 }, wc = { 0 }; \
+        \
+        a = b = c = (vtype){ 0 } + (uint32_t)(JHASH_INITVAL + length + initval); \
+        \
+        for (; len > 12; len -= 12, off += 12) { \
+            _Pragma("GCC unroll 8") \
+            for (int j = 0; j < (width); ++j) { \
+                wa[j] = __jhash_get_le32(k[j] + off); \
+                wb[j] = __jhash_get_le32(k[j] + off + 4); \
+                wc[j] = __jhash_get_le32(k[j] + off + 8); \
+            } \
+            a += wa; \
+            b += wb; \
+            c += wc; \
+            __jhash_vmix(a, b, c); \
+        } \
+        if (len) { \
+            _Pragma("GCC unroll 8") \
+            for (int j = 0; j < (width); ++j) { \
+                uint32_t t[3]; \
+                __jhash_tail(k[j] + off, len, t); \
+                wa[j] = t[0]; \
+                wb[j] = t[1]; \
+                wc[j] = t[2]; \
+            } \
+            a += wa; \
+            b += wb; \
+            c += wc; \
+            __jhash_vfinal(a, b, c); \
+        } \
+        \
+        memcpy(&hashes[i], &c, sizeof(c)); \
+    } \
+    jhash_bulk_scalar(keys + i, length, initval, hashes + i, n - i); \
+}
+
+DEFINE_JHASH_BULK(jhash_bulk_sse2, "sse2", v4u32, 4)
+DEFINE_JHASH_BULK(jhash_bulk_avx2, "avx2", v8u32, 8)
+#endif
+
+static void (*jhash_bulk_impl)(const void *const *, uint32_t, uint32_t, uint32_t *, size_t);
+
+/**
+ * Pick the widest implementation supported by the processor.
+ */
+static void jhash_bulk_resolve(void) {
+    void (*impl)(const void *const *, uint32_t, uint32_t, uint32_t *, size_t) = jhash_bulk_scalar;
+
+#ifdef JHASH_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        impl = jhash_bulk_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        impl = jhash_bulk_sse2;
+#endif
+
+    // Concurrent callers resolve to the same function
+    __atomic_store_n(&jhash_bulk_impl, impl, __ATOMIC_RELAXED);
+}
+
+/**
+ * Hash many keys of equal length at once.
+ *
+ * Keys are hashed in parallel using the widest vector instructions the
+ * processor supports, selected on first use. The results are identical
+ * to calling jhash() on every key.
+ *
+ * @param keys array of pointers to keys
+ * @param length the length of every key
+ * @param initval the previous hash, or an arbitray value
+ * @param hashes array receiving the hash of each key
+ * @param n number of keys
+ */
+void jhash_bulk(const void *const *keys, uint32_t length, uint32_t initval, uint32_t *hashes, size_t n) {
+    if (!__atomic_load_n(&jhash_bulk_impl, __ATOMIC_RELAXED))
+        jhash_bulk_resolve();
+
+    jhash_bulk_impl(keys, length, initval, hashes, n);
+}
@@ -0,0 +1,463 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lfhtable.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+/** Split order key of an entry, the top bit of the hash is replaced */
+#define lfhtable_so_regular(hash) (bitrev32((hash) | 0x80000000u))
+/** Split order key of the dummy node of a bucket */
+#define lfhtable_so_dummy(bucket) (bitrev32(bucket))
+
+/** Index of the segment holding a bucket */
+#define lfhtable_segment_idx(bucket) \
+    ((bucket) >> LFHTABLE_SEGMENT_SHIFT ? fls_long(bucket) - LFHTABLE_SEGMENT_SHIFT : 0)
+/** First bucket held in a segment */
+#define lfhtable_segment_base(idx) \
+    ((idx) ? 1UL << ((idx) + LFHTABLE_SEGMENT_SHIFT - 1) : 0)
+/** Number of buckets held in a segment */
+#define lfhtable_segment_size(idx) \
+    (1UL << ((idx) + LFHTABLE_SEGMENT_SHIFT - !!(idx)))
+
+/** Reader slot of the calling thread, assigned on first use */
+static __thread unsigned reader_slot = -1U;
+static atomic_uint reader_slots = ATOMIC_VAR_INIT(0);
+
+/**
+ * Initialize new table with given number of buckets.
+ *
+ * @param table hash table
+ * @param n aproximate size, rounded up to a power of two
+ * @return 0 on success, -1 otherwise
+ */
+int lfhtable_init_n(struct lfhtable *table, size_t n) {
+    atomic_uintptr_t *seg;
+
+    if (!table)
+        return -1;
+
+    seg = calloc(lfhtable_segment_size(0), sizeof(*seg));
+    if (!seg)
+        return -1;
+
+    n = clamp_t(size_t, n, 2, LFHTABLE_MAX_BUCKETS);
+    atomic_init(&table->head.next, 0);
+    table->head.so_key = lfhtable_so_dummy(0);
+    atomic_init(&table->size, roundup_pow_of_two(n));
+    atomic_init(&table->count, 0);
+
+    atomic_init(&seg[0], (uintptr_t)&table->head);
+    atomic_init(&table->segments[0], (uintptr_t)seg);
+    for (int i = 1; i < LFHTABLE_SEGMENTS; ++i)
+        atomic_init(&table->segments[i], 0);
+
+    atomic_init(&table->epoch, 0);
+    pthread_mutex_init(&table->sync_lock, NULL);
+    for (int i = 0; i < LFHTABLE_READER_SLOTS; ++i) {
+        atomic_init(&table->readers[i].count[0], 0);
+        atomic_init(&table->readers[i].count[1], 0);
+    }
+
+    return 0;
+}
+
+/**
+ * Initialize new table.
+ *
+ * @param table hash table
+ * @return 0 on success, -1 otherwise
+ */
+int lfhtable_init(struct lfhtable *table) {
+    return lfhtable_init_n(table, HASH_NUM_BUCKETS);
+}
+
+/**
+ * Destroy hash table.
+ *
+ * Entries are left untouched, there must be no concurrent operations.
+ *
+ * @param table hash table
+ */
+void lfhtable_destroy(struct lfhtable *table) {
+    struct lfhtable_node *node, *next;
+
+    if (!table)
+        return;
+
+    for (node = lfhtable_node_ptr(atomic_load(&table->head.next)); node; node = next) {
+        next = lfhtable_node_ptr(atomic_load(&node->next));
+        if (lfhtable_is_dummy(node))
+            free(node);
+    }
+    for (int i = 0; i < LFHTABLE_SEGMENTS; ++i)
+        free((void *)atomic_load(&table->segments[i]));
+    pthread_mutex_destroy(&table->sync_lock);
+}
+
+/**
+ * Enter read-side critical section.
+ *
+ * Sections may be nested.
+ *
+ * @param table hash table
+ * @return token to be passed to lfhtable_read_unlock()
+ */
+unsigned lfhtable_read_lock(struct lfhtable *table) {
+    unsigned idx;
+
+    if (reader_slot == -1U)
+        reader_slot = atomic_fetch_add(&reader_slots, 1) % LFHTABLE_READER_SLOTS;
+
+    idx = atomic_load_explicit(&table->epoch, memory_order_relaxed) & 1;
+    atomic_fetch_add_explicit(&table->readers[reader_slot].count[idx], 1, memory_order_relaxed);
+    // Pairs with the fence in lfhtable_synchronize()
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return reader_slot << 1 | idx;
+}
+
+/**
+ * Leave read-side critical section.
+ *
+ * @param table hash table
+ * @param token token returned by lfhtable_read_lock()
+ */
+void lfhtable_read_unlock(struct lfhtable *table, unsigned token) {
+    atomic_fetch_sub_explicit(&table->readers[token >> 1].count[token & 1], 1, memory_order_release);
+}
+
+/**
+ * Wait until all read-side critical sections in progress have finished.
+ *
+ * Entries removed before the call can be freed or reused once it returns.
+ * Must not be called from within a read-side critical section.
+ *
+ * @param table hash table
+ */
+void lfhtable_synchronize(struct lfhtable *table) {
+    unsigned idx;
+
+    pthread_mutex_lock(&table->sync_lock);
+
+    // Both phases are drained in turn, see chtable_synchronize()
+    for (int flip = 0; flip < 2; ++flip) {
+        // Pairs with the fence in lfhtable_read_lock()
+        atomic_thread_fence(memory_order_seq_cst);
+        idx = atomic_fetch_add(&table->epoch, 1) & 1;
+
+        for (int i = 0; i < LFHTABLE_READER_SLOTS; ++i) {
+            while (atomic_load_explicit(&table->readers[i].count[idx], memory_order_acquire))
+                sched_yield();
+        }
+    }
+
+    pthread_mutex_unlock(&table->sync_lock);
+}
+
+/**
+ * Look for a position in the list starting from a dummy node.
+ *
+ * Marked nodes found on the way are unlinked. The search stops at the
+ * first node whose split order key is greater than so_key, or equal to it
+ * and which matches the key. A NULL key only matches dummy nodes.
+ *
+ * @param head dummy node to start from
+ * @param so_key split order key to look for
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param hash the hash of the key
+ * @param pprev set to the link pointing to the returned node
+ * @return the node found, NULL at the end of the list
+ */
+static struct lfhtable_node *lfhtable_search(struct lfhtable_node *head, uint32_t so_key,
+        const void *key, size_t len, unsigned hash, atomic_uintptr_t **pprev) {
+    struct lfhtable_node *cur;
+    atomic_uintptr_t *prev;
+    uintptr_t next;
+
+retry:
+    prev = &head->next;
+    cur = lfhtable_node_ptr(atomic_load_explicit(prev, memory_order_acquire));
+    while (cur) {
+        next = atomic_load_explicit(&cur->next, memory_order_acquire);
+        if (next & LFHTABLE_MARK) {
+            uintptr_t expected = (uintptr_t)cur;
+
+            // The link fails to match when the previous node got marked
+            if (!atomic_compare_exchange_strong_explicit(prev, &expected, next & ~LFHTABLE_MARK,
+                    memory_order_acq_rel, memory_order_relaxed))
+                goto retry;
+            cur = lfhtable_node_ptr(next);
+            continue;
+        }
+
+        if (cur->so_key > so_key)
+            break;
+        if (cur->so_key == so_key && (!key ||
+                    htable_entry_match(container_of(cur, struct lfhtable_entry, node), hash, key, len)))
+            break;
+
+        prev = &cur->next;
+        cur = lfhtable_node_ptr(next);
+    }
+
+    *pprev = prev;
+    return cur;
+}
+
+/**
+ * Get the bucket pointer slot of a bucket, allocating its segment.
+ *
+ * @param table hash table
+ * @param bucket index of the bucket
+ * @return the slot, NULL on allocation failure
+ */
+static atomic_uintptr_t *lfhtable_slot(struct lfhtable *table, unsigned long bucket) {
+    unsigned idx = lfhtable_segment_idx(bucket);
+    atomic_uintptr_t *seg;
+    uintptr_t expected = 0;
+
+    seg = (atomic_uintptr_t *)atomic_load_explicit(&table->segments[idx], memory_order_acquire);
+    if (!seg) {
+        seg = calloc(lfhtable_segment_size(idx), sizeof(*seg));
+        if (!seg)
+            return NULL;
+        if (!atomic_compare_exchange_strong_explicit(&table->segments[idx], &expected, (uintptr_t)seg,
+                memory_order_acq_rel, memory_order_acquire)) {
+            free(seg);
+            seg = (atomic_uintptr_t *)expected;
+        }
+    }
+
+    return &seg[bucket - lfhtable_segment_base(idx)];
+}
+
+/**
+ * Get the dummy node of a bucket, inserting it into the list if needed.
+ *
+ * The dummy node is inserted after the one of its parent bucket, which is
+ * the bucket it was split from. If memory runs out, the closest ancestor
+ * bucket is returned instead, which precedes the bucket in split order and
+ * is thus a valid if slower starting point.
+ *
+ * @param table hash table
+ * @param bucket index of the bucket
+ */
+static struct lfhtable_node *lfhtable_bucket(struct lfhtable *table, unsigned long bucket) {
+    struct lfhtable_node *parent, *dummy, *cur;
+    atomic_uintptr_t *slot, *prev;
+    uintptr_t expected;
+
+    slot = lfhtable_slot(table, bucket);
+    if (slot && (dummy = (struct lfhtable_node *)atomic_load_explicit(slot, memory_order_acquire)))
+        return dummy;
+
+    // Bucket 0 is always initialized, the recursion ends there
+    parent = lfhtable_bucket(table, bucket & ~(1UL << (fls_long(bucket) - 1)));
+    if (!slot || !(dummy = malloc(sizeof(*dummy))))
+        return parent;
+
+    dummy->so_key = lfhtable_so_dummy(bucket);
+    for (;;) {
+        cur = lfhtable_search(parent, dummy->so_key, NULL, 0, 0, &prev);
+        if (cur && cur->so_key == dummy->so_key) {
+            // Lost the race against another thread
+            free(dummy);
+            dummy = cur;
+            break;
+        }
+
+        atomic_init(&dummy->next, (uintptr_t)cur);
+        expected = (uintptr_t)cur;
+        if (atomic_compare_exchange_weak_explicit(prev, &expected, (uintptr_t)dummy,
+                memory_order_release, memory_order_relaxed))
+            break;
+    }
+
+    atomic_store_explicit(slot, (uintptr_t)dummy, memory_order_release);
+    return dummy;
+}
+
+/**
+ * Get the dummy node of the bucket a hash falls in.
+ *
+ * @param table hash table
+ * @param hash hash of the key
+ */
+static inline struct lfhtable_node *lfhtable_bucket_of(struct lfhtable *table, unsigned hash) {
+    size_t size = atomic_load_explicit(&table->size, memory_order_relaxed);
+    return lfhtable_bucket(table, hash & (size - 1));
+}
+
+/**
+ * Add a new entry into hash table unless its key is already present.
+ *
+ * The table doubles its number of buckets once the load gets too high,
+ * buckets are then split lazily by the operations which access them.
+ *
+ * @param table the hash table to insert entry into
+ * @param entry the hash entry
+ * @param key the pointer to entry key
+ * @param len the key length
+ * @return NULL if the entry was added, the entry with the same key otherwise,
+ *         which is only safe to use within a read-side critical section
+ */
+struct lfhtable_entry *lfhtable_add(struct lfhtable *table, struct lfhtable_entry *entry,
+        void *key, size_t len) {
+    struct lfhtable_node *head, *cur;
+    atomic_uintptr_t *prev;
+    uintptr_t expected;
+    size_t count, size;
+    unsigned token;
+
+    entry->key = key;
+    entry->len = len;
+    entry->hash = jhash(key, len, 0);
+    entry->node.so_key = lfhtable_so_regular(entry->hash);
+
+    token = lfhtable_read_lock(table);
+    head = lfhtable_bucket_of(table, entry->hash);
+    for (;;) {
+        cur = lfhtable_search(head, entry->node.so_key, key, len, entry->hash, &prev);
+        if (cur && cur->so_key == entry->node.so_key) {
+            lfhtable_read_unlock(table, token);
+            return container_of(cur, struct lfhtable_entry, node);
+        }
+
+        atomic_init(&entry->node.next, (uintptr_t)cur);
+        expected = (uintptr_t)cur;
+        if (atomic_compare_exchange_weak_explicit(prev, &expected, (uintptr_t)&entry->node,
+                memory_order_release, memory_order_relaxed))
+            break;
+    }
+    lfhtable_read_unlock(table, token);
+
+    count = atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed) + 1;
+    size = atomic_load_explicit(&table->size, memory_order_relaxed);
+    if (count > size * LFHTABLE_GROW_LOAD && size < LFHTABLE_MAX_BUCKETS)
+        atomic_compare_exchange_strong_explicit(&table->size, &size, size << 1,
+                memory_order_relaxed, memory_order_relaxed);
+
+    return NULL;
+}
+
+/**
+ * Looks up the hash table for the presence of key.
+ *
+ * The lookup does not modify the list, removed entries are skipped. Must
+ * be called from within a read-side critical section, the returned entry
+ * remains valid until the section ends.
+ *
+ * @param table the hash table to look into
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return a pointer to the entry that matches the key, NULL otherwise
+ */
+struct lfhtable_entry *lfhtable_find(struct lfhtable *table, const void *key, size_t len) {
+    unsigned hash = jhash(key, len, 0);
+    uint32_t so_key = lfhtable_so_regular(hash);
+    struct lfhtable_node *cur;
+    uintptr_t next;
+
+    cur = lfhtable_bucket_of(table, hash);
+    while ((cur = lfhtable_node_ptr(atomic_load_explicit(&cur->next, memory_order_acquire)))) {
+        if (cur->so_key > so_key)
+            break;
+        if (cur->so_key == so_key) {
+            struct lfhtable_entry *e = container_of(cur, struct lfhtable_entry, node);
+            next = atomic_load_explicit(&cur->next, memory_order_acquire);
+            if (!(next & LFHTABLE_MARK) && htable_entry_match(e, hash, key, len))
+                return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Remove entry matching key, or the given entry if not NULL.
+ */
+static struct lfhtable_entry *__lfhtable_del(struct lfhtable *table, const void *key, size_t len,
+        unsigned hash, struct lfhtable_entry *entry) {
+    uint32_t so_key = lfhtable_so_regular(hash);
+    struct lfhtable_node *head, *cur;
+    atomic_uintptr_t *prev;
+    uintptr_t next, expected;
+
+    head = lfhtable_bucket_of(table, hash);
+    for (;;) {
+        cur = lfhtable_search(head, so_key, key, len, hash, &prev);
+        if (!cur || cur->so_key != so_key || (entry && cur != &entry->node))
+            return NULL;
+
+        // Marking the link makes the removal visible and blocks insertions after cur
+        next = atomic_load_explicit(&cur->next, memory_order_acquire);
+        if (next & LFHTABLE_MARK)
+            continue;
+        if (!atomic_compare_exchange_weak_explicit(&cur->next, &next, next | LFHTABLE_MARK,
+                memory_order_acq_rel, memory_order_relaxed))
+            continue;
+
+        // Unlink it or let a search do it
+        expected = (uintptr_t)cur;
+        if (!atomic_compare_exchange_strong_explicit(prev, &expected, next,
+                memory_order_acq_rel, memory_order_relaxed))
+            lfhtable_search(head, so_key, key, len, hash, &prev);
+
+        atomic_fetch_sub_explicit(&table->count, 1, memory_order_relaxed);
+        return container_of(cur, struct lfhtable_entry, node);
+    }
+}
+
+/**
+ * Remove entry with the given key from hash table.
+ *
+ * The entry is unlinked when the function returns, but must not be freed
+ * nor reused before lfhtable_synchronize() returns.
+ *
+ * @param table the hash table to remove entry from
+ * @param key the key to look for
+ * @param len the length of the key
+ * @return the removed entry, NULL if the key was not found
+ */
+struct lfhtable_entry *lfhtable_del_key(struct lfhtable *table, const void *key, size_t len) {
+    unsigned token = lfhtable_read_lock(table);
+    struct lfhtable_entry *e = __lfhtable_del(table, key, len, jhash(key, len, 0), NULL);
+
+    lfhtable_read_unlock(table, token);
+    return e;
+}
+
+/**
+ * Remove entry previously added to the hash table.
+ *
+ * The entry is unlinked when the function returns, but must not be freed
+ * nor reused before lfhtable_synchronize() returns.
+ *
+ * @param table the hash table to remove entry from
+ * @param entry the hash entry
+ * @return the removed entry, NULL if it was not in the table
+ */
+struct lfhtable_entry *lfhtable_del_entry(struct lfhtable *table, struct lfhtable_entry *entry) {
+    unsigned token = lfhtable_read_lock(table);
+    struct lfhtable_entry *e = __lfhtable_del(table, entry->key, entry->len, entry->hash, entry);
+
+    lfhtable_read_unlock(table, token);
+    return e;
+}
@@ -0,0 +1,333 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mhtable.h"
+#include "kernel.h"
+#include "log2.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Offset of the value of a slot */
+#define mhtable_val_off(slot) ((slot)->off + ALIGN((uint64_t)(slot)->klen, MHTABLE_ALIGN))
+
+/**
+ * Use a table held in memory.
+ *
+ * The memory must stay valid and unmodified while the table is in use.
+ *
+ * @param table hash table
+ * @param mem start of the table, aligned to MHTABLE_ALIGN
+ * @param size size of the memory
+ * @return 0 on success, -1 if the memory does not hold a valid table
+ */
+int mhtable_init_mem(struct mhtable *table, const void *mem, size_t size) {
+    const struct mhtable_header *hdr = mem;
+
+    if (!table || !mem || size < sizeof(*hdr) || (uintptr_t)mem % MHTABLE_ALIGN)
+        return -1;
+    if (hdr->magic != MHTABLE_MAGIC || hdr->version != MHTABLE_VERSION)
+        return -1;
+    if (hdr->size > size || !is_power_of_2(hdr->nbuckets))
+        return -1;
+    if (hdr->buckets < sizeof(*hdr) || hdr->buckets > hdr->size ||
+        (hdr->size - hdr->buckets) / sizeof(uint64_t) <= hdr->nbuckets)
+        return -1;
+    if (hdr->slots > hdr->size ||
+        (hdr->size - hdr->slots) / sizeof(struct mhtable_slot) < hdr->count)
+        return -1;
+
+    table->base = mem;
+    table->size = hdr->size;
+    table->mapped = 0;
+
+    return 0;
+}
+
+/**
+ * Map a table file.
+ *
+ * @param table hash table
+ * @param path file written by mhtable_builder_write()
+ * @return 0 on success, -1 otherwise
+ */
+int mhtable_open(struct mhtable *table, const char *path) {
+    struct stat st;
+    void *mem;
+    int fd;
+
+    if (!table)
+        return -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return -1;
+
+    if (mhtable_init_mem(table, mem, st.st_size) < 0) {
+        munmap(mem, st.st_size);
+        return -1;
+    }
+    // Unmap the whole file even if the table is shorter
+    table->size = st.st_size;
+    table->mapped = 1;
+
+    return 0;
+}
+
+/**
+ * Stop using a table, unmapping it if it was opened from a file.
+ *
+ * @param table hash table
+ */
+void mhtable_close(struct mhtable *table) {
+    if (table && table->base) {
+        if (table->mapped)
+            munmap((void *)table->base, table->size);
+        table->base = NULL;
+    }
+}
+
+/**
+ * Looks up the table for the presence of key.
+ *
+ * @param table hash table
+ * @param key the key to look for
+ * @param len the length of the key
+ * @param vlen if not NULL, receives the length of the value
+ * @return pointer to the value within the table, NULL if not found
+ */
+const void *mhtable_find(const struct mhtable *table, const void *key, size_t len, size_t *vlen) {
+    const struct mhtable_header *hdr = mhtable_header(table);
+    const uint64_t *buckets = (const uint64_t *)(table->base + hdr->buckets);
+    const struct mhtable_slot *slots = (const struct mhtable_slot *)(table->base + hdr->slots);
+    uint32_t hash = jhash(key, len, hdr->seed);
+    uint64_t b = hash & (hdr->nbuckets - 1);
+
+    for (uint64_t i = buckets[b]; i < buckets[b + 1]; ++i) {
+        const struct mhtable_slot *slot = &slots[i];
+        if (slot->hash == hash && slot->klen == len &&
+            memcmp(table->base + slot->off, key, len) == 0) {
+            if (vlen)
+                *vlen = slot->vlen;
+            return table->base + mhtable_val_off(slot);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Initialize new table builder.
+ *
+ * @param builder table builder
+ * @param seed seed of the key hash
+ * @return 0 on success, -1 otherwise
+ */
+int mhtable_builder_init(struct mhtable_builder *builder, uint32_t seed) {
+    if (!builder)
+        return -1;
+
+    memset(builder, 0, sizeof(*builder));
+    builder->seed = seed;
+
+    return 0;
+}
+
+/**
+ * Destroy table builder.
+ *
+ * @param builder table builder
+ */
+void mhtable_builder_destroy(struct mhtable_builder *builder) {
+    if (builder) {
+        free(builder->slots);
+        free(builder->data);
+        builder->slots = NULL;
+        builder->data = NULL;
+    }
+}
+
+/**
+ * Grow an array to hold at least n elements.
+ *
+ * @param arr array to grow
+ * @param size number of allocated elements
+ * @param n number of elements needed
+ * @param elem element size
+ * @return 0 on success, -1 otherwise
+ */
+static int mhtable_grow(void **arr, size_t *size, size_t n, size_t elem) {
+    size_t new_size = *size ? *size : 64;
+    void *p;
+
+    if (n <= *size)
+        return 0;
+    while (new_size < n)
+        new_size <<= 1;
+
+    p = realloc(*arr, new_size * elem);
+    if (!p)
+        return -1;
+
+    *arr = p;
+    *size = new_size;
+    return 0;
+}
+
+/**
+ * Add an entry to the table being built.
+ *
+ * Keys are not checked for uniqueness, lookups of a key added more than
+ * once find the value added first.
+ *
+ * @param builder table builder
+ * @param key the key
+ * @param len the key length
+ * @param val the value, copied into the table
+ * @param vlen the value length
+ * @return 0 on success, -1 otherwise
+ */
+int mhtable_builder_add(struct mhtable_builder *builder, const void *key, size_t len,
+        const void *val, size_t vlen) {
+    size_t klen_aligned = ALIGN(len, MHTABLE_ALIGN);
+    size_t need = builder->len + klen_aligned + ALIGN(vlen, MHTABLE_ALIGN);
+    struct mhtable_slot *slot;
+
+    if (len > UINT32_MAX || vlen > UINT32_MAX)
+        return -1;
+    if (mhtable_grow((void **)&builder->slots, &builder->slots_size, builder->count + 1,
+                sizeof(*builder->slots)) < 0)
+        return -1;
+    if (mhtable_grow((void **)&builder->data, &builder->data_size, need, 1) < 0)
+        return -1;
+
+    slot = &builder->slots[builder->count++];
+    slot->off = builder->len;
+    slot->hash = jhash(key, len, builder->seed);
+    slot->klen = len;
+    slot->vlen = vlen;
+    slot->__pad = 0;
+
+    // Padding is zeroed so that the output does not depend on heap contents
+    memset(builder->data + builder->len, 0, need - builder->len);
+    memcpy(builder->data + builder->len, key, len);
+    memcpy(builder->data + builder->len + klen_aligned, val, vlen);
+    builder->len = need;
+
+    return 0;
+}
+
+/**
+ * Write the table to a file.
+ *
+ * The file is written under a temporary name and renamed over path, so
+ * tables mapped from a previous version of the file stay valid.
+ *
+ * @param builder table builder
+ * @param path file name
+ * @return 0 on success, -1 otherwise
+ */
+int mhtable_builder_write(const struct mhtable_builder *builder, const char *path) {
+    struct mhtable_header hdr = { 0 };
+    struct mhtable_slot *slots;
+    uint64_t *buckets;
+    char *tmp = NULL;
+    FILE *f = NULL;
+    int ret = -1;
+
+    hdr.magic = MHTABLE_MAGIC;
+    hdr.version = MHTABLE_VERSION;
+    hdr.seed = builder->seed;
+    hdr.nbuckets = roundup_pow_of_two(max_t(size_t, builder->count, 1));
+    hdr.count = builder->count;
+    hdr.buckets = sizeof(hdr);
+    hdr.slots = hdr.buckets + (hdr.nbuckets + 1) * sizeof(uint64_t);
+    uint64_t data = hdr.slots + hdr.count * sizeof(struct mhtable_slot);
+    hdr.size = data + builder->len;
+
+    buckets = calloc(hdr.nbuckets + 1, sizeof(*buckets));
+    slots = malloc(max_t(size_t, builder->count, 1) * sizeof(*slots));
+    if (!buckets || !slots)
+        goto out;
+
+    // Counting sort of the slots by bucket, keeping the order of addition
+    for (size_t i = 0; i < builder->count; ++i)
+        buckets[(builder->slots[i].hash & (hdr.nbuckets - 1)) + 1]++;
+    for (uint64_t b = 0; b < hdr.nbuckets; ++b)
+        buckets[b + 1] += buckets[b];
+    for (size_t i = 0; i < builder->count; ++i) {
+        uint64_t b = builder->slots[i].hash & (hdr.nbuckets - 1);
+        slots[buckets[b]] = builder->slots[i];
+        slots[buckets[b]++].off += data;
+    }
+    // Each bucket index now points to the end of its bucket, shift them back
+    memmove(buckets + 1, buckets, hdr.nbuckets * sizeof(*buckets));
+    buckets[0] = 0;
+
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (!tmp)
+        goto out;
+    sprintf(tmp, "%s.tmp", path);
+
+    f = fopen(tmp, "wb");
+    if (!f)
+        goto out;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(buckets, sizeof(*buckets), hdr.nbuckets + 1, f);
+    fwrite(slots, sizeof(*slots), builder->count, f);
+    if (builder->len)
+        fwrite(builder->data, 1, builder->len, f);
+    if (fflush(f) || ferror(f)) {
+        unlink(tmp);
+        goto out;
+    }
+    if (fclose(f)) {
+        f = NULL;
+        unlink(tmp);
+        goto out;
+    }
+    f = NULL;
+
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    free(slots);
+    free(buckets);
+    free(tmp);
+    if (f)
+        fclose(f);
+    return ret;
+}
@@ -0,0 +1,337 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mph.h"
+#include "bitmap.h"
+#include "kernel.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Build state for one seed */
+struct mph_builder {
+    /** Key hashes */
+    uint64_t *hashes;
+    /** Key indexes grouped by bucket */
+    uint32_t *order;
+    /** Start of each bucket in order */
+    uint32_t *start;
+    /** Buckets sorted by decreasing size */
+    uint32_t *buckets;
+    /** Pilot of each bucket */
+    uint32_t *pilots;
+    /** Positions taken by the keys placed so far */
+    unsigned long *taken;
+    /** Positions of the keys of the bucket being placed */
+    uint32_t *pos;
+};
+
+static void mph_builder_free(struct mph_builder *b) {
+    free(b->hashes);
+    free(b->order);
+    free(b->start);
+    free(b->buckets);
+    free(b->pilots);
+    free(b->taken);
+    free(b->pos);
+}
+
+/**
+ * Sort keys into buckets and buckets by decreasing size.
+ *
+ * @return size of the largest bucket
+ */
+static uint32_t mph_sort(struct mph_builder *b, const struct mph_header *hdr) {
+    uint32_t *count, max = 0;
+
+    memset(b->start, 0, (hdr->nbuckets + 1) * sizeof(*b->start));
+    for (uint32_t i = 0; i < hdr->n; ++i)
+        b->start[mph_reduce(b->hashes[i] >> 32, hdr->nbuckets) + 1]++;
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i) {
+        max = max(max, b->start[i + 1]);
+        b->start[i + 1] += b->start[i];
+    }
+    for (uint32_t i = 0; i < hdr->n; ++i)
+        b->order[b->start[mph_reduce(b->hashes[i] >> 32, hdr->nbuckets)]++] = i;
+    // Each bucket start now points to the end of the bucket, shift them back
+    memmove(b->start + 1, b->start, hdr->nbuckets * sizeof(*b->start));
+    b->start[0] = 0;
+
+    // Counting sort by size, largest first
+    count = calloc(max + 2, sizeof(*count));
+    if (!count)
+        return UINT32_MAX;
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i)
+        count[max - (b->start[i + 1] - b->start[i]) + 1]++;
+    for (uint32_t i = 0; i <= max; ++i)
+        count[i + 1] += count[i];
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i)
+        b->buckets[count[max - (b->start[i + 1] - b->start[i])]++] = i;
+    free(count);
+
+    return max;
+}
+
+/**
+ * Check that no two keys of a bucket have the same hash.
+ *
+ * @return 0 if the hashes differ, 1 if two distinct keys share a hash,
+ *         -1 if the same key is present twice
+ */
+static int mph_check_bucket(const struct mph_builder *b, const uint32_t *keys, uint32_t n,
+        const void *const *data, const size_t *lens) {
+    for (uint32_t i = 0; i < n; ++i) {
+        for (uint32_t j = i + 1; j < n; ++j) {
+            uint32_t x = keys[i], y = keys[j];
+            if (b->hashes[x] != b->hashes[y])
+                continue;
+            if (lens[x] == lens[y] && memcmp(data[x], data[y], lens[x]) == 0)
+                return -1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Find a pilot for each bucket.
+ *
+ * @return 0 on success, 1 if another seed must be tried, -1 on duplicate keys
+ */
+static int mph_place(struct mph_builder *b, const struct mph_header *hdr,
+        const void *const *keys, const size_t *lens) {
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i) {
+        uint32_t bucket = b->buckets[i];
+        const uint32_t *members = &b->order[b->start[bucket]];
+        uint32_t n = b->start[bucket + 1] - b->start[bucket];
+        uint32_t pilot;
+        int ret;
+
+        // Buckets are sorted by size, only empty ones remain
+        if (n == 0)
+            break;
+
+        ret = mph_check_bucket(b, members, n, keys, lens);
+        if (ret)
+            return ret;
+
+        for (pilot = 0; pilot < MPH_MAX_PILOT; ++pilot) {
+            uint32_t j, k;
+
+            for (j = 0; j < n; ++j) {
+                uint32_t pos = __mph_position(b->hashes[members[j]], pilot, hdr->size);
+                if (test_bit(pos, b->taken))
+                    break;
+                for (k = 0; k < j && b->pos[k] != pos; ++k)
+                    ;
+                if (k < j)
+                    break;
+                b->pos[j] = pos;
+            }
+            if (j == n)
+                break;
+        }
+        if (pilot == MPH_MAX_PILOT)
+            return 1;
+
+        for (uint32_t j = 0; j < n; ++j)
+            set_bit(b->pos[j], b->taken);
+        b->pilots[bucket] = pilot;
+    }
+
+    return 0;
+}
+
+/**
+ * Build the serialized form from the placed keys.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int mph_finish(struct mph *mph, const struct mph_builder *b, struct mph_header *hdr) {
+    uint32_t max_pilot = 0, nremap = hdr->size - hdr->n;
+    uint32_t *remap;
+    uint8_t *pilots;
+    char *mem;
+
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i)
+        max_pilot = max(max_pilot, b->pilots[i]);
+    hdr->pilot_size = max_pilot <= UINT8_MAX ? 1 : max_pilot <= UINT16_MAX ? 2 : 4;
+
+    mem = malloc(sizeof(*hdr) + nremap * sizeof(*remap) + (size_t)hdr->nbuckets * hdr->pilot_size);
+    if (!mem)
+        return -1;
+    memcpy(mem, hdr, sizeof(*hdr));
+    remap = (uint32_t *)(mem + sizeof(*hdr));
+    pilots = (uint8_t *)(remap + nremap);
+
+    // Keys placed past n move to the positions left free below n
+    for (uint32_t p = hdr->n, free_pos = 0; p < hdr->size; ++p) {
+        remap[p - hdr->n] = 0;
+        if (!test_bit(p, b->taken))
+            continue;
+        while (test_bit(free_pos, b->taken))
+            free_pos++;
+        remap[p - hdr->n] = free_pos++;
+    }
+
+    for (uint32_t i = 0; i < hdr->nbuckets; ++i) {
+        uint16_t p16 = b->pilots[i];
+        switch (hdr->pilot_size) {
+        case 1:
+            pilots[i] = b->pilots[i];
+            break;
+        case 2:
+            memcpy(pilots + 2 * (size_t)i, &p16, sizeof(p16));
+            break;
+        default:
+            memcpy(pilots + 4 * (size_t)i, &b->pilots[i], sizeof(b->pilots[i]));
+            break;
+        }
+    }
+
+    mph->mem = mem;
+    mph->hdr = (const struct mph_header *)mem;
+    mph->remap = remap;
+    mph->pilots = pilots;
+
+    return 0;
+}
+
+/**
+ * Build a minimal perfect hash function for a set of keys.
+ *
+ * Building takes linear time and about 16 bytes of temporary memory per
+ * key. The function takes about 3.5 bits per key, 7 bits for tens of
+ * millions of keys when pilots no longer fit in 16 bits.
+ *
+ * @param mph perfect hash function
+ * @param keys array of pointers to keys
+ * @param lens array of key lengths
+ * @param n number of keys
+ * @param seed seed of the key hash, other seeds are derived from it when
+ *        the keys cannot be placed
+ * @return 0 on success, -1 on allocation failure, duplicate keys or if no
+ *         seed works
+ */
+int mph_build(struct mph *mph, const void *const *keys, const size_t *lens, size_t n, uint32_t seed) {
+    struct mph_header hdr = { 0 };
+    struct mph_builder b = { 0 };
+    int ret = -1;
+
+    if (!mph || n > INT_MAX / 2)
+        return -1;
+
+    hdr.magic = MPH_MAGIC;
+    hdr.n = n;
+    hdr.size = n ? (uint64_t)n * 100 / MPH_LOAD + 1 : 1;
+    hdr.nbuckets = max_t(size_t, DIV_ROUND_UP(n, MPH_LAMBDA), 1);
+
+    b.hashes = malloc(max_t(size_t, n, 1) * sizeof(*b.hashes));
+    b.order = malloc(max_t(size_t, n, 1) * sizeof(*b.order));
+    b.start = malloc((hdr.nbuckets + 1) * sizeof(*b.start));
+    b.buckets = malloc(hdr.nbuckets * sizeof(*b.buckets));
+    b.pilots = calloc(hdr.nbuckets, sizeof(*b.pilots));
+    b.taken = malloc(BITS_TO_LONGS(hdr.size) * sizeof(long));
+    if (!b.hashes || !b.order || !b.start || !b.buckets || !b.pilots || !b.taken)
+        goto out;
+
+    for (int attempt = 0; attempt < MPH_MAX_SEEDS; ++attempt) {
+        uint32_t max;
+
+        hdr.seed = seed + attempt * JHASH_INITVAL;
+        for (size_t i = 0; i < n; ++i)
+            b.hashes[i] = jhash64(keys[i], lens[i], hdr.seed);
+
+        max = mph_sort(&b, &hdr);
+        if (max == UINT32_MAX)
+            goto out;
+        free(b.pos);
+        b.pos = malloc(max_t(uint32_t, max, 1) * sizeof(*b.pos));
+        if (!b.pos)
+            goto out;
+
+        memset(b.taken, 0, BITS_TO_LONGS(hdr.size) * sizeof(long));
+        ret = mph_place(&b, &hdr, keys, lens);
+        if (ret < 0)
+            goto out;
+        if (ret == 0) {
+            ret = mph_finish(mph, &b, &hdr);
+            goto out;
+        }
+    }
+    ret = -1;
+
+out:
+    mph_builder_free(&b);
+    return ret;
+}
+
+/**
+ * Use a serialized perfect hash function in place.
+ *
+ * The memory must stay valid while the function is in use.
+ *
+ * @param mph perfect hash function
+ * @param mem serialized form, aligned to 4 bytes
+ * @param size size of the serialized form
+ * @return 0 on success, -1 if the memory does not hold a valid function
+ */
+int mph_load(struct mph *mph, const void *mem, size_t size) {
+    const struct mph_header *hdr = mem;
+
+    if (!mph || !mem || size < sizeof(*hdr) || (uintptr_t)mem % sizeof(uint32_t))
+        return -1;
+    if (hdr->magic != MPH_MAGIC || hdr->size < max_t(uint32_t, hdr->n, 1) || !hdr->nbuckets)
+        return -1;
+    if (hdr->pilot_size != 1 && hdr->pilot_size != 2 && hdr->pilot_size != 4)
+        return -1;
+
+    mph->hdr = hdr;
+    mph->remap = (const uint32_t *)(hdr + 1);
+    mph->pilots = (const uint8_t *)(mph->remap + (hdr->size - hdr->n));
+    mph->mem = NULL;
+    if (mph_serialized_size(mph) > size)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Destroy perfect hash function.
+ *
+ * @param mph perfect hash function
+ */
+void mph_destroy(struct mph *mph) {
+    if (mph) {
+        free(mph->mem);
+        mph->mem = NULL;
+        mph->hdr = NULL;
+    }
+}
+
+/**
+ * Returns the size of the serialized form of the function.
+ *
+ * @param mph perfect hash function
+ */
+size_t mph_serialized_size(const struct mph *mph) {
+    const struct mph_header *hdr = mph->hdr;
+
+    return sizeof(*hdr) + (size_t)(hdr->size - hdr->n) * sizeof(uint32_t) +
+        (size_t)hdr->nbuckets * hdr->pilot_size;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ostree.h"
+
+/**
+ * Recompute subtree sizes from node up to stop.
+ *
+ * @param rb first node to update
+ * @param stop node where to stop, NULL for the root
+ */
+static void ost_propagate(struct rb_node *rb, struct rb_node *stop) {
+    while (rb != stop) {
+        struct ost_node *node = ost_node(rb);
+        size_t size = 1 + ost_size(rb->rb_left) + ost_size(rb->rb_right);
+
+        if (node->size == size)
+            break;
+        node->size = size;
+        rb = rb_parent(rb);
+    }
+}
+
+static void ost_copy(struct rb_node *old, struct rb_node *new) {
+    ost_node(new)->size = ost_node(old)->size;
+}
+
+static void ost_rotate(struct rb_node *old, struct rb_node *new) {
+    ost_node(new)->size = ost_node(old)->size;
+    ost_node(old)->size = 1 + ost_size(old->rb_left) + ost_size(old->rb_right);
+}
+
+static const struct rb_augment_callbacks ost_augment = {
+    .propagate = ost_propagate,
+    .copy = ost_copy,
+    .rotate = ost_rotate,
+};
+
+/**
+ * Link node into order statistic tree and rebalance it.
+ *
+ * Takes the place of rb_link_node() followed by rb_insert_color().
+ *
+ * @param node node to link
+ * @param parent node parent
+ * @param link child pointer of parent to link node in
+ * @param root tree root
+ */
+void ost_link(struct ost_node *node, struct rb_node *parent, struct rb_node **link,
+        struct rb_root *root) {
+    node->size = 1;
+    rb_link_node(&node->rb, parent, link);
+    for (; parent; parent = rb_parent(parent))
+        ost_node(parent)->size++;
+
+    rb_insert_augmented(&node->rb, root, &ost_augment);
+}
+
+/**
+ * Erase node from order statistic tree.
+ *
+ * @param node erased node
+ * @param root tree root
+ */
+void ost_erase(struct ost_node *node, struct rb_root *root) {
+    rb_erase_augmented(&node->rb, root, &ost_augment);
+}
+
+/**
+ * Position of a node in the tree.
+ *
+ * @param node tree node
+ * @return number of nodes before node in rb_next() order
+ */
+size_t ost_rank(const struct ost_node *node) {
+    const struct rb_node *rb = &node->rb, *parent;
+    size_t rank = ost_size(rb->rb_left);
+
+    while ((parent = rb_parent(rb))) {
+        if (parent->rb_right == rb)
+            rank += ost_size(parent->rb_left) + 1;
+        rb = parent;
+    }
+
+    return rank;
+}
+
+/**
+ * Find the node at a given position.
+ *
+ * @param root tree root
+ * @param k position, 0 for rb_first()
+ * @return node with rank k, NULL if the tree holds k or fewer nodes
+ */
+struct ost_node *ost_select(const struct rb_root *root, size_t k) {
+    struct rb_node *rb = root->rb_node;
+
+    while (rb) {
+        size_t left = ost_size(rb->rb_left);
+
+        if (k == left)
+            return ost_node(rb);
+        if (k < left) {
+            rb = rb->rb_left;
+        } else {
+            k -= left + 1;
+            rb = rb->rb_right;
+        }
+    }
+
+    return NULL;
+}
@@ -16,14 +16,17 @@
  */
 
 #include "rbtree.h"
+#include "list.h"
 
 /**
  * Red black tree node left rotation.
  *
  * @param node rotated node
  * @param root tree root
+ * @param augment augmentation callbacks, NULL for plain trees
  */
-static void __rb_rotate_left(struct rb_node *node, struct rb_root *root) {
+static inline void __rb_rotate_left(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
     struct rb_node *right = node->rb_right;
     struct rb_node *parent = rb_parent(node);
 
@@ -42,6 +45,9 @@ static void __rb_rotate_left(struct rb_node *node, struct rb_root *root) {
     else
         root->rb_node = right;
     rb_set_parent(node, right);
+
+    if (augment)
+        augment->rotate(node, right);
 }
 
 /**
@@ -49,8 +55,10 @@ static void __rb_rotate_left(struct rb_node *node, struct rb_root *root) {
  *
  * @param node rotated node
  * @param root tree root
+ * @param augment augmentation callbacks, NULL for plain trees
  */
-static void __rb_rotate_right(struct rb_node *node, struct rb_root *root) {
+static inline void __rb_rotate_right(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
     struct rb_node *left = node->rb_left;
     struct rb_node *parent = rb_parent(node);
 
@@ -69,15 +77,23 @@ static void __rb_rotate_right(struct rb_node *node, struct rb_root *root) {
     else
         root->rb_node = left;
     rb_set_parent(node, left);
+
+    if (augment)
+        augment->rotate(node, left);
 }
 
 /**
- * Insert node into red black tree and check colors.
+ * Rebalance the tree after inserting a node.
+ *
+ * Inlined into both callers, so the plain tree pays nothing for the
+ * augmentation checks.
  *
  * @param node inserted node
  * @param root tree root
+ * @param augment augmentation callbacks, NULL for plain trees
  */
-void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+static inline __attribute__((always_inline)) void __rb_insert(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
     struct rb_node *parent, *gparent;
 
     while ((parent = rb_parent(node)) && rb_is_red(parent)) {
@@ -97,7 +113,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root) {
 
             if (parent->rb_right == node) {
                 register struct rb_node *tmp;
-                __rb_rotate_left(parent, root);
+                __rb_rotate_left(parent, root, augment);
                 tmp = parent;
                 parent = node;
                 node = tmp;
@@ -105,7 +121,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root) {
 
             rb_set_black(parent);
             rb_set_red(gparent);
-            __rb_rotate_right(gparent, root);
+            __rb_rotate_right(gparent, root, augment);
         } else {
             {
                 register struct rb_node *uncle = gparent->rb_left;
@@ -120,7 +136,7 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root) {
 
             if (parent->rb_left == node) {
                 register struct rb_node *tmp;
-                __rb_rotate_right(parent, root);
+                __rb_rotate_right(parent, root, augment);
                 tmp = parent;
                 parent = node;
                 node = tmp;
@@ -128,21 +144,49 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root) {
 
             rb_set_black(parent);
             rb_set_red(gparent);
-            __rb_rotate_left(gparent, root);
+            __rb_rotate_left(gparent, root, augment);
         }
     }
 
     rb_set_black(root->rb_node);
 }
 
+/**
+ * Insert node into red black tree and check colors.
+ *
+ * @param node inserted node
+ * @param root tree root
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    __rb_insert(node, root, NULL);
+}
+
+/**
+ * Rebalance an augmented tree after linking a node.
+ *
+ * The augmented values of the node and its ancestors must already account
+ * for the node, typically by updating them on the way down to the insertion
+ * point. Rotations are reported to the rotate callback.
+ *
+ * @param node inserted node
+ * @param root tree root
+ * @param augment augmentation callbacks
+ */
+void rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
+    __rb_insert(node, root, augment);
+}
+
 /**
  * Erase node from red black tree and check colors.
  *
  * @param node erased node
  * @param parent erased node parent
  * @param root tree root
+ * @param augment augmentation callbacks, NULL for plain trees
  */
-static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root) {
+static inline __attribute__((always_inline)) void __rb_erase_color(struct rb_node *node,
+        struct rb_node *parent, struct rb_root *root, const struct rb_augment_callbacks *augment) {
     struct rb_node *other;
 
     while ((!node || rb_is_black(node)) && node != root->rb_node) {
@@ -151,7 +195,7 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struc
             if (rb_is_red(other)) {
                 rb_set_black(other);
                 rb_set_red(parent);
-                __rb_rotate_left(parent, root);
+                __rb_rotate_left(parent, root, augment);
                 other = parent->rb_right;
             }
             if ((!other->rb_left || rb_is_black(other->rb_left)) &&
@@ -165,14 +209,14 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struc
                     if ((o_left = other->rb_left))
                         rb_set_black(o_left);
                     rb_set_red(other);
-                    __rb_rotate_right(other, root);
+                    __rb_rotate_right(other, root, augment);
                     other = parent->rb_right;
                 }
                 rb_set_color(other, rb_color(parent));
                 rb_set_black(parent);
                 if (other->rb_right)
                     rb_set_black(other->rb_right);
-                __rb_rotate_left(parent, root);
+                __rb_rotate_left(parent, root, augment);
                 node = root->rb_node;
                 break;
             }
@@ -181,7 +225,7 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struc
             if (rb_is_red(other)) {
                 rb_set_black(other);
                 rb_set_red(parent);
-                __rb_rotate_right(parent, root);
+                __rb_rotate_right(parent, root, augment);
                 other = parent->rb_left;
             }
             if ((!other->rb_left || rb_is_black(other->rb_left)) &&
@@ -195,14 +239,14 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struc
                     if ((o_right = other->rb_right))
                         rb_set_black(o_right);
                     rb_set_red(other);
-                    __rb_rotate_left(other, root);
+                    __rb_rotate_left(other, root, augment);
                     other = parent->rb_left;
                 }
                 rb_set_color(other, rb_color(parent));
                 rb_set_black(parent);
                 if (other->rb_left)
                     rb_set_black(other->rb_left);
-                __rb_rotate_right(parent, root);
+                __rb_rotate_right(parent, root, augment);
                 node = root->rb_node;
                 break;
             }
@@ -213,12 +257,14 @@ static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struc
 }
 
 /**
- * Erase node from red black tree
+ * Unlink a node and rebalance the tree.
  *
  * @param node erased node
  * @param root tree root
+ * @param augment augmentation callbacks, NULL for plain trees
  */
-void rb_erase(struct rb_node *node, struct rb_root *root) {
+static inline __attribute__((always_inline)) void __rb_erase(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
     struct rb_node *child, *parent;
     int color;
 
@@ -259,6 +305,15 @@ void rb_erase(struct rb_node *node, struct rb_root *root) {
         rb_set_parent(old->rb_left, node);
         if (old->rb_right)
             rb_set_parent(old->rb_right, node);
+
+        if (augment) {
+            // The successor takes over the value of the erased node, then
+            // the path it was removed from and its own value are updated
+            augment->copy(old, node);
+            if (parent != node)
+                augment->propagate(parent, node);
+            augment->propagate(node, NULL);
+        }
         goto color;
     }
 
@@ -276,9 +331,37 @@ void rb_erase(struct rb_node *node, struct rb_root *root) {
     else
         root->rb_node = child;
 
+    if (augment && parent)
+        augment->propagate(parent, NULL);
+
 color:
     if (color == RB_BLACK)
-        __rb_erase_color(child, parent, root);
+        __rb_erase_color(child, parent, root, augment);
+}
+
+/**
+ * Erase node from red black tree
+ *
+ * @param node erased node
+ * @param root tree root
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    __rb_erase(node, root, NULL);
+}
+
+/**
+ * Erase node from an augmented tree.
+ *
+ * Augmented values are recomputed from the parent of the unlinked node up,
+ * and rotations done while rebalancing are reported to the rotate callback.
+ *
+ * @param node erased node
+ * @param root tree root
+ * @param augment augmentation callbacks
+ */
+void rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+        const struct rb_augment_callbacks *augment) {
+    __rb_erase(node, root, augment);
 }
 
 static void rb_augment_path(struct rb_node *node, rb_augment_f func, void *data) {
@@ -477,3 +560,224 @@ void rb_replace_node(struct rb_node *victim, struct rb_node *new, struct rb_root
     /* copy the pointers/colour from the victim to the replacement */
     *new = *victim;
 }
+
+/**
+ * Build a balanced tree from a chain of nodes linked through rb_right.
+ *
+ * Both subtrees of every node differ in size by at most one, so all empty
+ * children lie at depth red_depth or the one below. Coloring the nodes at
+ * red_depth red and all others black gives every path the same number of
+ * black nodes, and red nodes only have empty children.
+ *
+ * @param chain first node of the chain, advanced past the consumed nodes
+ * @param n number of nodes to consume
+ * @param depth depth of the subtree root
+ * @param red_depth depth of the red nodes
+ * @return subtree root, its parent is left NULL
+ */
+static struct rb_node *__rb_build_chain(struct rb_node **chain, size_t n, unsigned depth,
+        unsigned red_depth) {
+    struct rb_node *node, *left;
+    size_t nleft = (n - 1) / 2;
+
+    if (!n)
+        return NULL;
+
+    left = __rb_build_chain(chain, nleft, depth + 1, red_depth);
+    node = *chain;
+    *chain = node->rb_right;
+
+    node->rb_parent_color = depth == red_depth ? RB_RED : RB_BLACK;
+    node->rb_left = left;
+    if (left)
+        rb_set_parent(left, node);
+    node->rb_right = __rb_build_chain(chain, n - 1 - nleft, depth + 1, red_depth);
+    if (node->rb_right)
+        rb_set_parent(node->rb_right, node);
+
+    return node;
+}
+
+/**
+ * Replace the tree with one built from a chain of nodes.
+ *
+ * @param root tree root
+ * @param chain nodes in rb_next() order linked through rb_right
+ * @param n number of nodes
+ */
+static void rb_build_chain(struct rb_root *root, struct rb_node *chain, size_t n) {
+    unsigned red_depth = 0;
+
+    // Largest depth d with 2^d <= n + 1
+    while (red_depth + 1 < sizeof(size_t) * 8 && ((size_t)2 << red_depth) - 1 <= n)
+        red_depth++;
+
+    root->rb_node = __rb_build_chain(&chain, n, 0, red_depth);
+    if (root->rb_node)
+        rb_set_black(root->rb_node);
+}
+
+/**
+ * Link the nodes of a subtree in rb_next() order through rb_right.
+ *
+ * @param node subtree root
+ * @param tail link to the last node, updated to the new last one
+ * @return number of nodes linked
+ */
+static size_t rb_chain_tree(struct rb_node *node, struct rb_node ***tail) {
+    struct rb_node *left, *right;
+    size_t n;
+
+    if (!node)
+        return 0;
+
+    // The right child is overwritten once the next node is linked
+    left = node->rb_left;
+    right = node->rb_right;
+    n = rb_chain_tree(left, tail);
+    **tail = node;
+    *tail = &node->rb_right;
+    return n + 1 + rb_chain_tree(right, tail);
+}
+
+/**
+ * Build a tree from sorted nodes in linear time.
+ *
+ * The tree is balanced and colored at once, with no rebalancing.
+ *
+ * @param root tree root, any previous content is dropped
+ * @param nodes nodes in the order rb_next() is to visit them
+ * @param n number of nodes
+ */
+void rb_build(struct rb_root *root, struct rb_node **nodes, size_t n) {
+    for (size_t i = 0; i + 1 < n; ++i)
+        nodes[i]->rb_right = nodes[i + 1];
+
+    rb_build_chain(root, n ? nodes[0] : NULL, n);
+}
+
+/**
+ * Build a tree from a sorted list in linear time.
+ *
+ * The list is left as it is, each entry of type holding both the list
+ * node and the tree node. See rb_build_list_entry().
+ *
+ * @param root tree root, any previous content is dropped
+ * @param head list of entries in the order rb_next() is to visit them
+ * @param offset offset of the tree node from the list node of an entry
+ */
+void rb_build_list(struct rb_root *root, struct list_head *head, ptrdiff_t offset) {
+    struct rb_node *chain = NULL, **tail = &chain;
+    struct list_head *pos;
+    size_t n = 0;
+
+    list_for_each(pos, head) {
+        *tail = (struct rb_node *)((char *)pos + offset);
+        tail = &(*tail)->rb_right;
+        n++;
+    }
+
+    rb_build_chain(root, chain, n);
+}
+
+/**
+ * Add sorted nodes which all follow the last node of the tree.
+ *
+ * An empty tree is built with rb_build(). Otherwise the nodes are linked
+ * one by one below the last node, with no descent from the root and an
+ * amortized constant amount of rebalancing each, so appending a run takes
+ * time linear in its length whatever the size of the tree.
+ *
+ * @param root tree root
+ * @param nodes nodes in the order rb_next() is to visit them
+ * @param n number of nodes
+ */
+void rb_append(struct rb_root *root, struct rb_node **nodes, size_t n) {
+    struct rb_node *last = rb_last(root);
+
+    if (!last) {
+        rb_build(root, nodes, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        rb_link_node(nodes[i], last, &last->rb_right);
+        rb_insert_color(nodes[i], root);
+        last = nodes[i];
+    }
+}
+
+/**
+ * Erase a run of consecutive nodes.
+ *
+ * Nodes are erased from first on, each one's successor being found before
+ * it is erased, so a run of k nodes costs about as much as k calls to
+ * rb_next() plus the rebalancing. A run covering the whole tree is
+ * unlinked without any rebalancing.
+ *
+ * The erased nodes are linked through rb_right in rb_next() order, ready
+ * to be freed or passed back to rb_build().
+ *
+ * @param root tree root
+ * @param first first node to erase, NULL for none
+ * @param end node following the run, NULL to erase up to the last node
+ * @param erased if not NULL, receives the first erased node
+ * @return number of erased nodes
+ */
+size_t rb_erase_range(struct rb_root *root, struct rb_node *first, struct rb_node *end,
+        struct rb_node **erased) {
+    struct rb_node *chain = NULL, **tail = &chain, *next;
+    size_t n = 0;
+
+    if (first && !end && first == rb_first(root)) {
+        n = rb_chain_tree(root->rb_node, &tail);
+        root->rb_node = NULL;
+    } else {
+        for (; first && first != end; first = next) {
+            next = rb_next(first);
+            rb_erase(first, root);
+            *tail = first;
+            tail = &first->rb_right;
+            n++;
+        }
+    }
+
+    *tail = NULL;
+    if (erased)
+        *erased = chain;
+    return n;
+}
+
+/**
+ * Merge sorted nodes into the tree in linear time.
+ *
+ * The tree nodes and the new nodes are merged into a single sorted chain
+ * from which the tree is rebuilt, which costs time linear in the total
+ * number of nodes. Nodes comparing equal to tree nodes follow them.
+ *
+ * @param root tree root
+ * @param nodes nodes in the order rb_next() is to visit them
+ * @param n number of nodes
+ * @param cmp comparison with the convention of rb_insert(), cmp(a, b) < 0
+ *   if b comes before a
+ */
+void rb_merge(struct rb_root *root, struct rb_node **nodes, size_t n,
+        int (*cmp)(const struct rb_node *a, const struct rb_node *b)) {
+    struct rb_node *tree = NULL, **tail = &tree, *chain = NULL, *node;
+    size_t count = rb_chain_tree(root->rb_node, &tail), i = 0;
+
+    *tail = NULL;
+    tail = &chain;
+    while (tree || i < n) {
+        if (tree && (i == n || cmp(tree, nodes[i]) >= 0)) {
+            node = tree;
+            tree = tree->rb_right;
+        } else {
+            node = nodes[i++];
+        }
+        *tail = node;
+        tail = &node->rb_right;
+    }
+
+    rb_build_chain(root, chain, count + n);
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of libkern.
+ *
+ * libkern is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libkern is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libkern.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bloom.h"
+
+#include <stdio.h>
+
+/** Number of times the whole element set is replaced */
+#define NUM_ROUNDS 8
+/** Number of elements never added which are looked up */
+#define NUM_PROBES (1 << 18)
+/** Largest accepted false positive rate, relative to the configured one */
+#define MAX_FPR_RATIO 2.0
+
+/* Elements are identified by sequence number, probes use numbers never added */
+#define element_hash(i) jhash_1word((uint32_t)(i), 0)
+#define probe_hash(i) jhash_1word((uint32_t)(i), 1)
+
+/*
+ * Replace the element set of a counting filter NUM_ROUNDS times and check
+ * that the live elements are all found and that the false positive rate
+ * stays within MAX_FPR_RATIO of the configured one.
+ */
+static int test_churn(const char *filter, size_t n, unsigned flags) {
+  struct cbloom cb;
+  size_t fn = 0, fp = 0;
+  double fpr;
+
+  if (cbloom_init(&cb, n, BLOOM_DEFAULT_FPR, flags) < 0) {
+    fprintf(stderr, "%s n=%zu: init failed\n", filter, n);
+    return 1;
+  }
+
+  for (size_t i = 0; i < n * NUM_ROUNDS; ++i) {
+    if (i >= n) {
+      cbloom_remove(&cb, element_hash(i - n));
+    }
+    cbloom_add(&cb, element_hash(i));
+  }
+
+  for (size_t i = n * (NUM_ROUNDS - 1); i < n * NUM_ROUNDS; ++i) {
+    fn += !cbloom_test(&cb, element_hash(i));
+  }
+  for (size_t i = 0; i < NUM_PROBES; ++i) {
+    fp += cbloom_test(&cb, probe_hash(i));
+  }
+  fpr = (double)fp / NUM_PROBES;
+  cbloom_destroy(&cb);
+
+  printf("%-14s n=%-7zu fpr %.4f\n", filter, n, fpr);
+  if (fn) {
+    fprintf(stderr, "%s n=%zu: %zu false negatives\n", filter, n, fn);
+    return 1;
+  }
+  if (fpr > MAX_FPR_RATIO * BLOOM_DEFAULT_FPR) {
+    fprintf(stderr, "%s n=%zu: fpr %.4f above %.4f\n", filter, n, fpr,
+        MAX_FPR_RATIO * BLOOM_DEFAULT_FPR);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  static const size_t sizes[] = { 1000, 1 << 16 };
+  int failed = 0;
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    failed |= test_churn("cbloom", sizes[i], 0);
+    failed |= test_churn("cbloom-blocked", sizes[i], CBLOOM_BLOCKED);
+  }
+
+  return failed;
+}